@@ -0,0 +1,32 @@
+#include "global.h"
+#include <stdint.h>
+#include "curve.h"
+
+// Steering: offset of steering state from 1500 --> offset of output from angle_trim
+struct curve steering_curve = {
+	CURVE_IDENTITY,
+};
+
+// Throttle: offset of speed state from 1500 --> offset from the first moving value
+// (min_forward_moving for forward, max_backward_moving for backward)
+struct curve throttle_curve = {
+	CURVE_IDENTITY,
+};
+
+// Constant time: one table lookup and one 32-bit multiplication
+int16_t curve_apply(const struct curve *curve, int16_t x) {
+	if (x <= CURVE_X0)
+		return curve->y[0] + (x - CURVE_X0);
+	if (x >= CURVE_X_END)
+		return curve->y[CURVE_POINTS - 1] + (x - CURVE_X_END);
+
+	uint16_t offset = x - CURVE_X0;
+	uint8_t i = offset >> CURVE_SHIFT;
+	uint8_t fraction = offset & ((1 << CURVE_SHIFT) - 1);
+	return curve->y[i] + (int16_t) ((((int32_t) curve->y[i + 1] - curve->y[i]) * fraction) >> CURVE_SHIFT);
+}
+
+// For raw signals (e.g. receiver pass-through) centered around `center`
+uint16_t curve_apply_us(const struct curve *curve, uint16_t us, uint16_t center) {
+	return curve_apply(curve, us - center) + center;
+}
@@ -0,0 +1,30 @@
+#ifndef _CURVE_H_
+#define _CURVE_H_
+
+#include <stdint.h>
+
+// Response curve: piecewise linear function of offset from neutral, given by
+// values in CURVE_POINTS equidistant points from CURVE_X0 with step
+// (1 << CURVE_SHIFT). Outside of the table it continues with slope 1.
+#define CURVE_POINTS 17
+#define CURVE_SHIFT  6
+#define CURVE_X0     (-512)
+#define CURVE_X_END  (CURVE_X0 + ((CURVE_POINTS - 1) << CURVE_SHIFT))
+
+// Identity: each point is mapped to itself
+#define CURVE_IDENTITY { \
+	-512, -448, -384, -320, -256, -192, -128, -64, \
+	0, \
+	64, 128, 192, 256, 320, 384, 448, 512 }
+
+struct curve {
+	int16_t y[CURVE_POINTS];
+};
+
+extern struct curve steering_curve;
+extern struct curve throttle_curve;
+
+int16_t curve_apply(const struct curve *curve, int16_t x);
+uint16_t curve_apply_us(const struct curve *curve, uint16_t us, uint16_t center);
+
+#endif
@@ -0,0 +1,34 @@
+#include "global.h"
+#include <stdint.h>
+#include "speed_controller.h"
+#include "failsafe.h"
+
+struct failsafe_config failsafe_config = {
+	1000 | 0x8000, // full brake, enforce brake state
+	50,            // hold it for 0.5 s
+};
+
+// Reasons of failsafe active during last pass of select_action() (0 if none)
+uint8_t failsafe_reason = 0;
+// Time when the last failsafe started
+uint16_t failsafe_start_time = 0;
+
+uint8_t failsafe_pass_reason = 0;
+
+// Use instead of speed command, whenever some input timeouts
+void failsafe_apply(uint8_t reason, uint16_t time) {
+	if ((failsafe_reason == 0) && (failsafe_pass_reason == 0))
+		failsafe_start_time = time; // New failsafe
+	failsafe_pass_reason |= reason;
+
+	if ((uint16_t) (time - failsafe_start_time) < failsafe_config.brake_time)
+		speed_controller_try_set_speed_state(failsafe_config.brake_state);
+	else
+		speed_controller_try_set_neutral_1(); // Next forward command will not be delayed, backward will start with brake
+}
+
+// Call at the end of each select_action(), failsafe ends when it was not applied during whole pass
+void failsafe_pass_done(void) {
+	failsafe_reason = failsafe_pass_reason;
+	failsafe_pass_reason = 0;
+}
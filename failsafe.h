@@ -0,0 +1,23 @@
+#ifndef _FAILSAFE_H_
+#define _FAILSAFE_H_
+
+#include <stdint.h>
+
+// Failsafe reasons (bit field)
+#define FAILSAFE_SERIAL         0x01 // No valid packet within timeout given by the packet
+#define FAILSAFE_CAPTURE_SPEED  0x02 // No throttle signal from receiver
+#define FAILSAFE_CAPTURE_ANGLE  0x04 // No steering signal from receiver
+
+struct failsafe_config {
+	uint16_t brake_state; // speed state used for braking (same format as serial speed commands)
+	uint8_t brake_time;   // number of periods to hold the brake, then settle to neutral-1
+};
+
+extern struct failsafe_config failsafe_config;
+extern uint8_t failsafe_reason;
+extern uint16_t failsafe_start_time;
+
+void failsafe_apply(uint8_t reason, uint16_t time);
+void failsafe_pass_done(void);
+
+#endif
@@ -0,0 +1,86 @@
+#include "global.h"
+#include <stdint.h>
+#include "flight_recorder.h"
+
+#ifdef FLIGHT_RECORDER
+
+uint8_t flight_recorder_flags = 0;
+uint16_t flight_recorder_capture_speed[FLIGHT_RECORDER_CAPTURE_LOG_SIZE];
+uint16_t flight_recorder_capture_angle[FLIGHT_RECORDER_CAPTURE_LOG_SIZE];
+uint8_t flight_recorder_serial[FLIGHT_RECORDER_SERIAL_LOG_SIZE];
+uint8_t flight_recorder_serial_len = 0;
+
+void flight_recorder_log_serial(uint8_t byte) {
+	if (flight_recorder_serial_len < FLIGHT_RECORDER_SERIAL_LOG_SIZE) {
+		flight_recorder_serial[flight_recorder_serial_len] = byte;
+		flight_recorder_serial_len++;
+	}
+	else {
+		flight_recorder_flags |= FLIGHT_RECORDER_SERIAL_OVERFLOW;
+	}
+}
+
+void flight_recorder_log_capture(uint8_t channel, uint16_t counter) {
+	uint16_t *log = flight_recorder_capture_angle;
+	uint8_t count = FLIGHT_RECORDER_ANGLE_CAPTURES(flight_recorder_flags);
+	uint8_t one = 0x04;
+	if (channel == FLIGHT_RECORDER_CAPTURE_SPEED) {
+		log = flight_recorder_capture_speed;
+		count = FLIGHT_RECORDER_SPEED_CAPTURES(flight_recorder_flags);
+		one = 0x01;
+	}
+
+	if (count == FLIGHT_RECORDER_CAPTURE_LOG_SIZE) {
+		// Keep the last ones, they are the most important for the filter
+		for (uint8_t i = 1; i < FLIGHT_RECORDER_CAPTURE_LOG_SIZE; i++)
+			log[i - 1] = log[i];
+		log[FLIGHT_RECORDER_CAPTURE_LOG_SIZE - 1] = counter;
+		flight_recorder_flags |= FLIGHT_RECORDER_CAPTURE_OVERFLOW;
+		return;
+	}
+	log[count] = counter;
+	flight_recorder_flags += one;
+}
+
+// Writes record of the last period into buffer (at most FLIGHT_RECORDER_MAX_LEN bytes) and starts a new one
+uint8_t flight_recorder_write(unsigned char *buffer, uint16_t time, uint8_t state, uint16_t speed_us, uint16_t angle_us, uint8_t driver_state, uint8_t encoder_edges) {
+	uint8_t len = FLIGHT_RECORDER_HEADER_LEN;
+	uint8_t sum = 0;
+	uint8_t sum_of_sums = 0;
+
+	buffer[0] = FLIGHT_RECORDER_TAG;
+	buffer[2] = (time >> 8);
+	buffer[3] = time;
+	buffer[4] = state;
+	buffer[5] = (speed_us >> 8);
+	buffer[6] = speed_us;
+	buffer[7] = (angle_us >> 8);
+	buffer[8] = angle_us;
+	buffer[9] = driver_state;
+	buffer[10] = flight_recorder_flags;
+	buffer[11] = encoder_edges;
+	for (uint8_t i = 0; i < FLIGHT_RECORDER_SPEED_CAPTURES(flight_recorder_flags); i++) {
+		buffer[len++] = (flight_recorder_capture_speed[i] >> 8);
+		buffer[len++] = flight_recorder_capture_speed[i];
+	}
+	for (uint8_t i = 0; i < FLIGHT_RECORDER_ANGLE_CAPTURES(flight_recorder_flags); i++) {
+		buffer[len++] = (flight_recorder_capture_angle[i] >> 8);
+		buffer[len++] = flight_recorder_capture_angle[i];
+	}
+	for (uint8_t i = 0; i < flight_recorder_serial_len; i++)
+		buffer[len++] = flight_recorder_serial[i];
+	buffer[1] = len + FLIGHT_RECORDER_CHECKSUM_LEN;
+
+	for (uint8_t i = 0; i < len; i++) {
+		sum += buffer[i];
+		sum_of_sums += sum;
+	}
+	buffer[len++] = sum;
+	buffer[len++] = sum_of_sums;
+
+	flight_recorder_flags = 0;
+	flight_recorder_serial_len = 0;
+	return len;
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef _FLIGHT_RECORDER_H_
+#define _FLIGHT_RECORDER_H_
+
+#include <stdint.h>
+
+// Trace record format, shared with host tools (see host/sb_trace.h)
+//
+// Each record describes one Timer1 period (16-bit values are sent upper byte first):
+//  0      'R'
+//  1      length of whole record including this header and checksum
+//  2-3    time
+//  4      global_state
+//  5-6    OCR1_SPEED value for next period
+//  7-8    OCR1_ANGLE value for next period
+//  9      speed_controller_current_state
+//  10     flags (see bellow)
+//  11     wheel_encoder_edges
+//  12-    raw speed counters (number is given by flags)
+//         raw angle counters (number is given by flags)
+//         raw serial bytes received during this period
+//  last 2 checksum: sum of all previous bytes and sum of those partial sums (both modulo 256)
+
+#define FLIGHT_RECORDER_TAG             'R'
+#define FLIGHT_RECORDER_HEADER_LEN      12
+#define FLIGHT_RECORDER_SERIAL_LOG_SIZE 24
+#define FLIGHT_RECORDER_CAPTURE_LOG_SIZE 3 // per channel
+#define FLIGHT_RECORDER_CHECKSUM_LEN    2
+#define FLIGHT_RECORDER_MAX_LEN         (FLIGHT_RECORDER_HEADER_LEN + 4 * FLIGHT_RECORDER_CAPTURE_LOG_SIZE + FLIGHT_RECORDER_SERIAL_LOG_SIZE + FLIGHT_RECORDER_CHECKSUM_LEN)
+
+// Flags
+#define FLIGHT_RECORDER_CAPTURE_SPEED   0x03 // Number of speed captures processed in this period
+#define FLIGHT_RECORDER_CAPTURE_ANGLE   0x0C // Number of angle captures processed in this period (shifted by 2)
+#define FLIGHT_RECORDER_CAPTURE_OVERFLOW 0x40 // More captures were processed, only the last ones are recorded
+#define FLIGHT_RECORDER_SERIAL_OVERFLOW 0x80 // Some of the received bytes did not fit into the record
+
+#define FLIGHT_RECORDER_SPEED_CAPTURES(flags) ((flags) & FLIGHT_RECORDER_CAPTURE_SPEED)
+#define FLIGHT_RECORDER_ANGLE_CAPTURES(flags) (((flags) & FLIGHT_RECORDER_CAPTURE_ANGLE) >> 2)
+
+#ifdef FLIGHT_RECORDER
+
+void flight_recorder_log_serial(uint8_t byte);
+void flight_recorder_log_capture(uint8_t channel, uint16_t counter);
+uint8_t flight_recorder_write(unsigned char *buffer, uint16_t time, uint8_t state, uint16_t speed_us, uint16_t angle_us, uint8_t driver_state, uint8_t encoder_edges);
+
+#else
+
+#define flight_recorder_log_serial(byte) do {} while (0)
+#define flight_recorder_log_capture(channel, counter) do {} while (0)
+
+#endif
+#endif
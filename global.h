@@ -1,10 +1,25 @@
 #ifndef _GLOBAL_H_
 #define _GLOBAL_H_
+
+// Number of servo outputs, more than two are generated by interrupts (see servo.c)
+#ifndef SERVO_CHANNELS
+#define SERVO_CHANNELS 2
+#endif
+
+// Bits of GPIOR0 (bits 0 and 1 are used by input_capture_asm.S)
+#define SERVO_OVERFLOW_BIT 2 // Timer1 reached TOP, set by TIMER1_CAPT_vect (scheduler_asm.S)
+#define SERVO_COMMIT_BIT   3 // New edge tables are ready, swap them at TOP (servo_asm.S)
+
 #ifdef __ASSEMBLER__
 
 #define sreg_irq_save r2
 #define irq_r16       r16
 
+#elif defined(HOST_BUILD)
+
+// Native build of the firmware logic (see host/), no registers are reserved
+#include <stdint.h>
+
 #else
 
 #include <stdint.h>
@@ -0,0 +1,227 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "esc_predict.h"
+
+// Checks esc_predict against test vectors generated by esc_vectors and
+// measures its throughput on random candidate sequences.
+
+struct vectors {
+	struct esc_predict_config config;
+	size_t count, steps;
+	uint8_t *initial_state, *initial_counter;
+	uint16_t *commands, *speed_us; // [step * count + sequence]
+	uint8_t *state, *counter;
+};
+
+static int read_vectors(const char *filename, struct vectors *v) {
+	FILE *f = fopen(filename, "r");
+	unsigned c[7], state, counter, steps, command, speed_us;
+	size_t capacity = 0;
+
+	if (!f) {
+		perror(filename);
+		return 0;
+	}
+	memset(v, 0, sizeof(*v));
+	if (fscanf(f, " config %x %x %x %x %x %x %x", &c[0], &c[1], &c[2], &c[3], &c[4], &c[5], &c[6]) != 7)
+		goto invalid;
+	v->config.min_forward_moving = c[0];
+	v->config.min_forward = c[1];
+	v->config.max_neutral = c[2];
+	v->config.min_neutral = c[3];
+	v->config.max_backward = c[4];
+	v->config.max_backward_moving = c[5];
+	v->config.transition_filter = c[6];
+	for (int i = 0; i < ESC_PREDICT_CURVE_POINTS; i++) {
+		if (fscanf(f, i ? " %x" : " curve %x", &c[0]) != 1)
+			goto invalid;
+		v->config.throttle_curve[i] = (int16_t) c[0];
+	}
+
+	// Sequences are stored one after another, we need them step by step
+	struct { uint16_t command, speed_us; uint8_t state, counter; } *steps_read = NULL;
+	while (fscanf(f, " seq %x %x %x", &state, &counter, &steps) == 3) {
+		if (v->count == 0)
+			v->steps = steps;
+		else if (steps != v->steps)
+			goto invalid;
+		if (v->count == capacity) {
+			capacity = capacity ? 2 * capacity : 64;
+			v->initial_state = realloc(v->initial_state, capacity);
+			v->initial_counter = realloc(v->initial_counter, capacity);
+			steps_read = realloc(steps_read, capacity * steps * sizeof(*steps_read));
+		}
+		v->initial_state[v->count] = state;
+		v->initial_counter[v->count] = counter;
+		for (size_t step = 0; step < steps; step++) {
+			if (fscanf(f, " %x %x %x %x", &command, &speed_us, &state, &counter) != 4)
+				goto invalid;
+			steps_read[v->count * steps + step].command = command;
+			steps_read[v->count * steps + step].speed_us = speed_us;
+			steps_read[v->count * steps + step].state = state;
+			steps_read[v->count * steps + step].counter = counter;
+		}
+		v->count++;
+	}
+	if (!feof(f) || (v->count == 0))
+		goto invalid;
+	fclose(f);
+
+	v->commands = malloc(v->count * v->steps * sizeof(uint16_t));
+	v->speed_us = malloc(v->count * v->steps * sizeof(uint16_t));
+	v->state = malloc(v->count * v->steps);
+	v->counter = malloc(v->count * v->steps);
+	for (size_t i = 0; i < v->count; i++) {
+		for (size_t step = 0; step < v->steps; step++) {
+			v->commands[step * v->count + i] = steps_read[i * v->steps + step].command;
+			v->speed_us[step * v->count + i] = steps_read[i * v->steps + step].speed_us;
+			v->state[step * v->count + i] = steps_read[i * v->steps + step].state;
+			v->counter[step * v->count + i] = steps_read[i * v->steps + step].counter;
+		}
+	}
+	free(steps_read);
+	return 1;
+
+invalid:
+	fprintf(stderr, "%s: invalid vector file\n", filename);
+	fclose(f);
+	return 0;
+}
+
+static unsigned check_scalar(const struct vectors *v) {
+	unsigned errors = 0;
+	for (size_t i = 0; i < v->count; i++) {
+		uint8_t state = v->initial_state[i];
+		uint8_t counter = v->initial_counter[i];
+		for (size_t step = 0; step < v->steps; step++) {
+			size_t n = step * v->count + i;
+			uint16_t speed_us = esc_predict_action(&v->config, v->commands[n], state);
+			esc_predict_simulate(&v->config, speed_us, &state, &counter);
+			if ((speed_us != v->speed_us[n]) || (state != v->state[n]) || (counter != v->counter[n])) {
+				if (errors++ < 10)
+					printf("scalar: sequence %zu step %zu: command %04x: got %u/%02x/%u, expected %u/%02x/%u\n",
+							i, step, v->commands[n], speed_us, state, counter, v->speed_us[n], v->state[n], v->counter[n]);
+				break;
+			}
+		}
+	}
+	return errors;
+}
+
+// Output arrays of esc_predict_run() start at a cache line
+static void *alloc_lines(size_t size) {
+	return aligned_alloc(64, (size + 63) / 64 * 64);
+}
+
+static unsigned check_vector(const struct vectors *v, unsigned threads) {
+	uint8_t *state = alloc_lines(v->count);
+	uint8_t *counter = alloc_lines(v->count);
+	uint8_t *trajectory = alloc_lines(v->count * v->steps);
+	unsigned errors = 0;
+
+	memcpy(state, v->initial_state, v->count);
+	memcpy(counter, v->initial_counter, v->count);
+	esc_predict_run(&v->config, v->count, v->steps, v->commands, state, counter, trajectory, threads);
+
+	for (size_t i = 0; i < v->count; i++) {
+		size_t last = (v->steps - 1) * v->count + i;
+		for (size_t step = 0; step < v->steps; step++) {
+			size_t n = step * v->count + i;
+			if (trajectory[n] != v->state[n]) {
+				if (errors++ < 10)
+					printf("vector (%u threads): sequence %zu step %zu: got %02x, expected %02x\n",
+							threads, i, step, trajectory[n], v->state[n]);
+				break;
+			}
+		}
+		if ((state[i] != v->state[last]) || (counter[i] != v->counter[last])) {
+			if (errors++ < 10)
+				printf("vector (%u threads): sequence %zu: final state %02x/%u, expected %02x/%u\n",
+						threads, i, state[i], counter[i], v->state[last], v->counter[last]);
+		}
+	}
+	free(state);
+	free(counter);
+	free(trajectory);
+	return errors;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void benchmark(size_t count, size_t steps, unsigned threads, unsigned repeat) {
+	struct esc_predict_config config;
+	uint16_t *commands = malloc(count * steps * sizeof(uint16_t));
+	uint8_t *state = alloc_lines(count);
+	uint8_t *counter = alloc_lines(count);
+	uint8_t *trajectory = alloc_lines(count * steps);
+	double best = 1e9;
+
+	esc_predict_default_config(&config);
+	srand(1);
+	for (size_t n = 0; n < count * steps; n++)
+		commands[n] = (1000 + rand() % 1001) | ((rand() & 0x03) << 14);
+
+	for (unsigned r = 0; r < repeat; r++) {
+		memset(state, 0x77, count);
+		memset(counter, 1, count);
+		double start = now();
+		esc_predict_run(&config, count, steps, commands, state, counter, trajectory, threads);
+		double elapsed = now() - start;
+		if (elapsed < best)
+			best = elapsed;
+	}
+	printf("%zu candidates x %zu steps, %u threads: %.3f ms (%.2f ns per step)\n",
+			count, steps, threads, best * 1e3, best * 1e9 / (count * steps));
+	free(commands);
+	free(state);
+	free(counter);
+	free(trajectory);
+}
+
+int main(int argc, char *argv[]) {
+	size_t count = 4096;
+	size_t steps = 100;
+	unsigned threads = 1;
+	unsigned errors = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:s:t:")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = atoi(optarg);
+				break;
+			case 's':
+				steps = atoi(optarg);
+				break;
+			case 't':
+				threads = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-n candidates] [-s steps] [-t threads] [vectors...]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	for (int i = optind; i < argc; i++) {
+		struct vectors v;
+		if (!read_vectors(argv[i], &v))
+			return 2;
+		errors += check_scalar(&v);
+		errors += check_vector(&v, 1);
+		errors += check_vector(&v, threads > 1 ? threads : 4);
+		printf("%s: %zu sequences x %zu steps, %u errors\n", argv[i], v.count, v.steps, errors);
+	}
+	if (errors)
+		return 1;
+
+	benchmark(count, steps, threads, 20);
+	return 0;
+}
@@ -0,0 +1,291 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include "esc_predict.h"
+
+void esc_predict_default_config(struct esc_predict_config *config) {
+	config->min_forward_moving = 1563;
+	config->min_forward = 1490;
+	config->max_neutral = 1510;
+	config->min_neutral = 1446;
+	config->max_backward = 1466;
+	config->max_backward_moving = 1400;
+	config->transition_filter = 4;
+	for (int i = 0; i < ESC_PREDICT_CURVE_POINTS; i++)
+		config->throttle_curve[i] = ESC_PREDICT_CURVE_X0 + (i << ESC_PREDICT_CURVE_SHIFT);
+}
+
+#define CURVE_X_END (ESC_PREDICT_CURVE_X0 + ((ESC_PREDICT_CURVE_POINTS - 1) << ESC_PREDICT_CURVE_SHIFT))
+#define CURVE_MASK  ((1 << ESC_PREDICT_CURVE_SHIFT) - 1)
+
+// Sum is computed in 16 bits, as on AVR
+static inline uint16_t neutral_us(const struct esc_predict_config *config) {
+	return (uint16_t) (config->min_forward + config->max_backward) / 2;
+}
+
+/*
+ * Scalar version, follows speed_controller.c line by line
+ */
+
+// curve_apply() from curve.c, all results are truncated to 16 bits as on AVR
+static int16_t curve_apply(const int16_t *y, int16_t x) {
+	if (x <= ESC_PREDICT_CURVE_X0)
+		return y[0] + (x - ESC_PREDICT_CURVE_X0);
+	if (x >= CURVE_X_END)
+		return y[ESC_PREDICT_CURVE_POINTS - 1] + (x - CURVE_X_END);
+
+	uint16_t offset = x - ESC_PREDICT_CURVE_X0;
+	uint8_t i = offset >> ESC_PREDICT_CURVE_SHIFT;
+	uint8_t fraction = offset & CURVE_MASK;
+	return y[i] + (int16_t) ((((int32_t) y[i + 1] - y[i]) * fraction) >> ESC_PREDICT_CURVE_SHIFT);
+}
+
+uint16_t esc_predict_action(const struct esc_predict_config *config, uint16_t speed_state, uint8_t state) {
+	uint16_t desired_speed = speed_state & 0x3FFF;
+	if (desired_speed == 1500)
+		return neutral_us(config);
+	else if (desired_speed > 1500)
+		return curve_apply(config->throttle_curve, desired_speed - 1500) + config->min_forward_moving;
+	else if (((speed_state >> 8) & 0xC0) == 0x00)
+		return curve_apply(config->throttle_curve, desired_speed - 1500) + config->max_backward_moving;
+	else if (((speed_state >> 8) & 0xC0) == 0x80) {
+		if (state & 0x44)
+			return config->max_neutral + 1;
+		else
+			return curve_apply(config->throttle_curve, desired_speed - 1500) + config->max_backward_moving;
+	}
+	else {
+		if (state & 0x11)
+			return curve_apply(config->throttle_curve, desired_speed - 1500) + config->max_backward_moving;
+		else if (state & 0x22)
+			return neutral_us(config);
+		else
+			return curve_apply(config->throttle_curve, desired_speed - 1500) + config->max_backward_moving;
+	}
+}
+
+void esc_predict_simulate(const struct esc_predict_config *config, uint16_t speed_us, uint8_t *state, uint8_t *counter) {
+	uint8_t current = *state;
+	uint8_t new_state = current & 0x0F;
+	uint8_t old = (current | (current << 4)) & 0xF0;
+
+	if (speed_us >= config->min_forward)
+		new_state |= 0x10;
+	if ((speed_us <= config->max_neutral) && (speed_us >= config->min_neutral))
+		new_state |= (old & 0x50) | ((old & 0x20) << 1);
+	if (speed_us <= config->max_backward)
+		new_state |= (old & 0x60) | ((old & 0x10) << 1);
+
+	if (new_state != current) {
+		new_state = (new_state & 0xF0) | (old >> 4);
+		*counter = 1;
+	}
+	else {
+		(*counter)++;
+		if (*counter >= config->transition_filter) {
+			new_state = (new_state & 0xF0) | (new_state >> 4);
+			(*counter)--;
+		}
+	}
+	*state = new_state;
+}
+
+/*
+ * Vector version: LANES candidates at once, each lane holds one state byte
+ * (widened to 16 bits, so it can be mixed with signal lengths). Comparisons
+ * give all-ones lanes, so each if/else above is a blend of both branches.
+ */
+
+// One vector register of 16-bit lanes (SSE2 is always available on x86-64)
+#ifdef __AVX2__
+#define LANES 16
+#else
+#define LANES 8
+#endif
+
+typedef uint16_t vec_u16 __attribute__((vector_size(LANES * sizeof(uint16_t))));
+typedef uint8_t vec_u8 __attribute__((vector_size(LANES * sizeof(uint8_t))));
+typedef int16_t vec_s16 __attribute__((vector_size(LANES * sizeof(int16_t))));
+typedef int32_t vec_s32 __attribute__((vector_size(LANES * sizeof(int32_t))));
+
+static inline vec_u16 blend(vec_u16 mask, vec_u16 a, vec_u16 b) {
+	return (a & mask) | (b & ~mask);
+}
+
+static inline vec_u16 is_nonzero(vec_u16 a) {
+	return (vec_u16) (a != 0);
+}
+
+// Table lookup is replaced by one masked pass over all segments
+static inline vec_u16 vector_curve(const int16_t *y, vec_u16 x) {
+	vec_u16 below = (vec_u16) ((vec_s16) x <= ESC_PREDICT_CURVE_X0);
+	vec_u16 above = (vec_u16) ((vec_s16) x >= CURVE_X_END);
+	vec_u16 offset = x - (uint16_t) ESC_PREDICT_CURVE_X0;
+	vec_u16 index = offset >> ESC_PREDICT_CURVE_SHIFT;
+	vec_s32 fraction = __builtin_convertvector(offset & CURVE_MASK, vec_s32);
+	vec_s32 base = {};
+	vec_s32 delta = {};
+
+	for (int i = 0; i < ESC_PREDICT_CURVE_POINTS - 1; i++) {
+		vec_s32 match = __builtin_convertvector((vec_s16) (index == (uint16_t) i), vec_s32);
+		base |= match & y[i];
+		delta |= match & ((int32_t) y[i + 1] - y[i]);
+	}
+	vec_u16 inside = (vec_u16) __builtin_convertvector(base + ((delta * fraction) >> ESC_PREDICT_CURVE_SHIFT), vec_s16);
+	vec_u16 outside_below = x + (uint16_t) (y[0] - ESC_PREDICT_CURVE_X0);
+	vec_u16 outside_above = x + (uint16_t) (y[ESC_PREDICT_CURVE_POINTS - 1] - CURVE_X_END);
+	return blend(below, outside_below, blend(above, outside_above, inside));
+}
+
+static inline vec_u16 vector_action(const struct esc_predict_config *config, vec_u16 speed_state, vec_u16 state, int identity) {
+	vec_u16 desired = speed_state & 0x3FFF;
+	vec_u16 mode = speed_state & 0xC000;
+	vec_u16 neutral = (vec_u16) {} + neutral_us(config);
+	vec_u16 offset = identity ? desired - 1500 : vector_curve(config->throttle_curve, desired - 1500);
+	vec_u16 forward_us = offset + config->min_forward_moving;
+	vec_u16 backward_us = offset + config->max_backward_moving;
+
+	vec_u16 brake_us = blend(is_nonzero(state & 0x44), (vec_u16) {} + (uint16_t) (config->max_neutral + 1), backward_us);
+	vec_u16 reverse_us = blend(~is_nonzero(state & 0x11) & is_nonzero(state & 0x22), neutral, backward_us);
+	vec_u16 below_us = blend((vec_u16) (mode == 0x8000), brake_us, blend((vec_u16) (mode == 0), backward_us, reverse_us));
+
+	return blend((vec_u16) (desired == 1500), neutral,
+			blend((vec_u16) (desired > 1500), forward_us, below_us));
+}
+
+static inline void vector_simulate(const struct esc_predict_config *config, vec_u16 speed_us, vec_u16 *state, vec_u16 *counter) {
+	vec_u16 current = *state;
+	vec_u16 new_state = current & 0x0F;
+	vec_u16 old = (current | (current << 4)) & 0xF0;
+	vec_u16 neutral = (vec_u16) (speed_us <= config->max_neutral) & (vec_u16) (speed_us >= config->min_neutral);
+
+	new_state |= (vec_u16) (speed_us >= config->min_forward) & 0x10;
+	new_state |= neutral & ((old & 0x50) | ((old & 0x20) << 1));
+	new_state |= (vec_u16) (speed_us <= config->max_backward) & ((old & 0x60) | ((old & 0x10) << 1));
+
+	vec_u16 changed = (vec_u16) (new_state != current);
+	vec_u16 count = (*counter + 1) & 0xFF;
+	vec_u16 done = (vec_u16) (count >= config->transition_filter);
+
+	vec_u16 kept = blend(done, (new_state & 0xF0) | (new_state >> 4), new_state);
+	*state = blend(changed, (new_state & 0xF0) | (old >> 4), kept);
+	*counter = blend(changed, (vec_u16) {} + 1, (count - (done & 1)) & 0xFF);
+}
+
+static void run_scalar(const struct esc_predict_config *config, size_t count, size_t first, size_t last, size_t steps,
+		const uint16_t *commands, uint8_t *state, uint8_t *counter, uint8_t *trajectory) {
+	for (size_t i = first; i < last; i++) {
+		for (size_t step = 0; step < steps; step++) {
+			uint16_t speed_us = esc_predict_action(config, commands[step * count + i], state[i]);
+			esc_predict_simulate(config, speed_us, &state[i], &counter[i]);
+			if (trajectory)
+				trajectory[step * count + i] = state[i];
+		}
+	}
+}
+
+static int curve_is_identity(const struct esc_predict_config *config) {
+	for (int i = 0; i < ESC_PREDICT_CURVE_POINTS; i++) {
+		if (config->throttle_curve[i] != ESC_PREDICT_CURVE_X0 + (i << ESC_PREDICT_CURVE_SHIFT))
+			return 0;
+	}
+	return 1;
+}
+
+static inline void run_vector_block(const struct esc_predict_config *config, size_t count, size_t i, size_t steps,
+		const uint16_t *commands, uint8_t *state, uint8_t *counter, uint8_t *trajectory, int identity) {
+	vec_u8 packed;
+	vec_u16 lanes_state, lanes_counter;
+
+	memcpy(&packed, state + i, sizeof(packed));
+	lanes_state = __builtin_convertvector(packed, vec_u16);
+	memcpy(&packed, counter + i, sizeof(packed));
+	lanes_counter = __builtin_convertvector(packed, vec_u16);
+
+	for (size_t step = 0; step < steps; step++) {
+		vec_u16 command, speed_us;
+		memcpy(&command, commands + step * count + i, sizeof(command));
+		speed_us = vector_action(config, command, lanes_state, identity);
+		vector_simulate(config, speed_us, &lanes_state, &lanes_counter);
+		if (trajectory) {
+			packed = __builtin_convertvector(lanes_state, vec_u8);
+			memcpy(trajectory + step * count + i, &packed, sizeof(packed));
+		}
+	}
+
+	packed = __builtin_convertvector(lanes_state, vec_u8);
+	memcpy(state + i, &packed, sizeof(packed));
+	packed = __builtin_convertvector(lanes_counter, vec_u8);
+	memcpy(counter + i, &packed, sizeof(packed));
+}
+
+static void run_vector(const struct esc_predict_config *config, size_t count, size_t first, size_t last, size_t steps,
+		const uint16_t *commands, uint8_t *state, uint8_t *counter, uint8_t *trajectory) {
+	int identity = curve_is_identity(config); // Common case is much faster
+	size_t i;
+	for (i = first; i + LANES <= last; i += LANES) {
+		if (identity)
+			run_vector_block(config, count, i, steps, commands, state, counter, trajectory, 1);
+		else
+			run_vector_block(config, count, i, steps, commands, state, counter, trajectory, 0);
+	}
+	// Remaining candidates
+	run_scalar(config, count, i, last, steps, commands, state, counter, trajectory);
+}
+
+struct worker {
+	pthread_t thread;
+	const struct esc_predict_config *config;
+	size_t count, first, last, steps;
+	const uint16_t *commands;
+	uint8_t *state, *counter, *trajectory;
+};
+
+static void *worker_main(void *arg) {
+	struct worker *w = arg;
+	run_vector(w->config, w->count, w->first, w->last, w->steps, w->commands, w->state, w->counter, w->trajectory);
+	return NULL;
+}
+
+#define MAX_THREADS 64
+// Candidates per chunk are rounded to this (multiple of LANES), one byte of
+// state, counter and trajectory each, so 64 B cache lines are not shared
+#define CHUNK_ALIGN 64
+
+void esc_predict_run(const struct esc_predict_config *config, size_t count, size_t steps,
+		const uint16_t *commands, uint8_t *state, uint8_t *counter, uint8_t *trajectory, unsigned threads) {
+	struct worker workers[MAX_THREADS];
+	size_t chunk;
+	unsigned started = 0;
+
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+	if ((threads <= 1) || (count < 2 * CHUNK_ALIGN)) {
+		run_vector(config, count, 0, count, steps, commands, state, counter, trajectory);
+		return;
+	}
+
+	// Chunk boundaries are at whole cache lines of state and counter (if both
+	// arrays are 64 B aligned) and of trajectory (if count is a multiple of 64)
+	chunk = (count + threads - 1) / threads;
+	chunk = (chunk + CHUNK_ALIGN - 1) / CHUNK_ALIGN * CHUNK_ALIGN;
+	for (size_t first = 0; first < count; first += chunk) {
+		struct worker *w = &workers[started];
+		w->config = config;
+		w->count = count;
+		w->first = first;
+		w->last = (first + chunk < count) ? first + chunk : count;
+		w->steps = steps;
+		w->commands = commands;
+		w->state = state;
+		w->counter = counter;
+		w->trajectory = trajectory;
+		if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+			worker_main(w); // Could not start the thread, do the work here
+			continue;
+		}
+		started++;
+	}
+	for (unsigned t = 0; t < started; t++)
+		pthread_join(workers[t].thread, NULL);
+}
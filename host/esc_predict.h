@@ -0,0 +1,57 @@
+#ifndef _ESC_PREDICT_H_
+#define _ESC_PREDICT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Host implementation of the Traxxas driver model from speed_controller.c.
+// Results are bit-exact with the firmware (check them with esc_bench and
+// vectors generated by esc_vectors from the firmware code itself).
+//
+// Each step does the same as the firmware in one period: command (speed state,
+// same format as in serial protocol) is translated to the output signal by
+// calculate_action() and the signal is applied by
+// speed_controller_simulate_state().
+
+// Same as CURVE_* in curve.h
+#define ESC_PREDICT_CURVE_POINTS 17
+#define ESC_PREDICT_CURVE_SHIFT  6
+#define ESC_PREDICT_CURVE_X0     (-512)
+
+struct esc_predict_config {
+	uint16_t min_forward_moving;
+	uint16_t min_forward;
+	uint16_t max_neutral;
+	uint16_t min_neutral;
+	uint16_t max_backward;
+	uint16_t max_backward_moving;
+	uint8_t transition_filter;
+	int16_t throttle_curve[ESC_PREDICT_CURVE_POINTS]; // throttle_curve in curve.c
+};
+
+// Values of current_config in speed_controller.c and identity curve
+void esc_predict_default_config(struct esc_predict_config *config);
+
+// Single candidate, reference implementation
+uint16_t esc_predict_action(const struct esc_predict_config *config, uint16_t speed_state, uint8_t state);
+void esc_predict_simulate(const struct esc_predict_config *config, uint16_t speed_us, uint8_t *state, uint8_t *counter);
+
+// Evaluates `count` candidate sequences of `steps` commands each.
+//
+// commands are stored step by step: commands[step * count + candidate]
+// state, counter: state of each candidate (speed_controller_current_state and
+//                 transition_counter), updated in place
+// trajectory:     if not NULL, state after each step is stored there
+//                 (trajectory[step * count + candidate])
+// threads:        number of worker threads (0 or 1 runs in calling thread),
+//                 each gets a multiple of 64 candidates, allocate the arrays
+//                 aligned to 64 B so they do not write to the same cache line
+void esc_predict_run(const struct esc_predict_config *config, size_t count, size_t steps,
+		const uint16_t *commands, uint8_t *state, uint8_t *counter, uint8_t *trajectory, unsigned threads);
+
+// Helpers for interpretation of state (see README.md)
+static inline uint8_t esc_predict_possible_states(uint8_t state) {
+	return (state | (state >> 4)) & 0x0F;
+}
+
+#endif
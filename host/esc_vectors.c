@@ -0,0 +1,118 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../speed_controller.h"
+#include "../curve.h"
+
+// Generates test vectors for esc_predict from the firmware driver model
+// (speed_controller.c compiled natively). Check them with esc_bench.
+//
+// Output format (all numbers hexadecimal):
+//   config <min_forward_moving> <min_forward> <max_neutral> <min_neutral> <max_backward> <max_backward_moving> <transition_filter>
+//   curve <throttle_curve point 0> ... <point 16>    (16-bit two's complement)
+//   seq <state> <counter> <steps>
+//   <command> <speed_us> <state> <counter>      (once per step, state after the step)
+
+// speed_controller.c
+extern uint8_t transition_counter;
+uint16_t calculate_action(uint16_t desired_speed_state);
+
+static uint32_t random_state = 1;
+
+static uint32_t random_next(void) {
+	// xorshift32, same vectors on every host
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+static const uint8_t initial_states[] = {0x77, 0x11, 0x22, 0x44, 0x12, 0x14, 0x24, 0x21, 0x42, 0x66, 0x33};
+static const uint16_t modes[] = {0x0000, 0x4000, 0x8000, 0xC000};
+
+static uint16_t random_command(void) {
+	uint32_t r = random_next();
+	switch (r & 0x07) {
+		case 0:
+			return 1500 | modes[(r >> 3) & 0x03]; // Neutral
+		case 1:
+			return r >> 16; // Anything, including invalid values
+		case 2:
+		case 3:
+			return (1500 + ((r >> 8) & 0x3F) - 0x20) | modes[(r >> 3) & 0x03]; // Close to neutral
+		default:
+			return (1000 + (r >> 8) % 1001) | modes[(r >> 3) & 0x03];
+	}
+}
+
+int main(int argc, char *argv[]) {
+	unsigned sequences = 256;
+	unsigned steps = 64;
+	int random_curve = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:s:r:c")) != -1) {
+		switch (opt) {
+			case 'n':
+				sequences = atoi(optarg);
+				break;
+			case 's':
+				steps = atoi(optarg);
+				break;
+			case 'r':
+				random_state = strtoul(optarg, NULL, 0) | 1;
+				break;
+			case 'c':
+				random_curve = 1;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-n sequences] [-s steps] [-r seed] [-c] > vectors\n", argv[0]);
+				fprintf(stderr, "  -c  use random throttle curve instead of the compiled-in one\n");
+				return 2;
+		}
+	}
+
+	printf("config %x %x %x %x %x %x %x\n", current_config.min_forward_moving, current_config.min_forward,
+			current_config.max_neutral, current_config.min_neutral, current_config.max_backward,
+			current_config.max_backward_moving, current_config.transition_filter);
+
+	if (random_curve) {
+		// Monotonic, but with any slope (including large steps)
+		int16_t y = -600 - (random_next() % 400);
+		for (int i = 0; i < CURVE_POINTS; i++) {
+			throttle_curve.y[i] = y;
+			y += random_next() % 160;
+		}
+	}
+	printf("curve");
+	for (int i = 0; i < CURVE_POINTS; i++)
+		printf(" %x", (uint16_t) throttle_curve.y[i]);
+	printf("\n");
+
+	for (unsigned i = 0; i < sequences; i++) {
+		uint16_t command = 1500;
+		unsigned hold = 0;
+
+		if (i % 4 == 3)
+			speed_controller_current_state = random_next(); // Unreachable states must match too
+		else
+			speed_controller_current_state = initial_states[random_next() % sizeof(initial_states)];
+		transition_counter = 1 + random_next() % current_config.transition_filter;
+		printf("seq %x %x %x\n", speed_controller_current_state, transition_counter, steps);
+
+		for (unsigned step = 0; step < steps; step++) {
+			if (hold == 0) {
+				command = random_command();
+				hold = 1 + random_next() % 8; // Transitions need a few periods with the same command
+			}
+			hold--;
+
+			// Same order as in main loop: action is selected from the state after last period
+			uint16_t speed_us = calculate_action(command);
+			speed_controller_simulate_state(speed_us);
+			printf("%x %x %x %x\n", command, speed_us, speed_controller_current_state, transition_counter);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,200 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../global.h"
+#include <avr/io.h>
+#include "../hw.h"
+#include "../sb_states.h"
+#include "../speed_controller.h"
+#include "../wheel_encoder.h"
+#include "sb_trace.h"
+
+// Replays trace recorded by FLIGHT_RECORDER build through the firmware logic
+// compiled natively and compares its outputs with the recorded ones.
+//
+// Each record is replayed as one Timer1 period in the order of the firmware
+// main loop: select_action() runs right after the previous TOP (before any
+// input of this period), then received serial bytes and captures are fed to
+// the main loop tasks, select_action() is run until the mode settles, and the
+// period is closed by check_timer_overflow(). Order of events inside one
+// period is not recorded, so decisions made in the last few microseconds
+// before TOP may differ.
+//
+// After each difference the mode, driver state and outputs are taken from the
+// record, so one divergence is reported once (unless -c is given).
+
+// main.c (firmware `time` is renamed by host/Makefile to avoid clash with libc)
+extern uint8_t global_state;
+extern uint16_t firmware_time;
+extern uint16_t substate_start_time;
+void uart_input_tick(void);
+void manage_input_capture(void);
+void check_timer_overflow(void);
+void switch_state_serial(void);
+void select_action(void);
+extern int out_buffer_pos;
+extern int out_buffer_len;
+
+// avr_io.c
+extern volatile uint16_t counter_0;
+extern volatile uint16_t counter_1;
+
+#define SETTLE_PASSES 16
+#define MAX_LOST_RECORDS 100 // Larger gap in time is not replayed, we just resynchronize
+
+static uint8_t capture_done_mask(volatile uint16_t *counter) {
+	return (counter == &counter_0) ? _BV(INT0) : _BV(INT1);
+}
+
+static void replay_inputs(const struct sb_trace_record *record) {
+	for (uint8_t i = 0; i < record->serial_len; i++) {
+		UDR0 = record->serial[i];
+		UCSR0A |= _BV(RXC0);
+		uart_input_tick();
+		UCSR0A &= ~_BV(RXC0);
+	}
+
+	for (int i = 0; (i < record->speed_captures) || (i < record->angle_captures); i++) {
+		EIMSK = _BV(INT0) | _BV(INT1); // Both captures are running
+		if (i < record->speed_captures) {
+			COUNTER_SPEED = record->capture_speed[i];
+			EIMSK &= ~capture_done_mask(&COUNTER_SPEED);
+		}
+		if (i < record->angle_captures) {
+			COUNTER_ANGLE = record->capture_angle[i];
+			EIMSK &= ~capture_done_mask(&COUNTER_ANGLE);
+		}
+		manage_input_capture();
+	}
+}
+
+// Main loop runs after each event, run it until the mode settles (as firmware does before sleeping)
+static void settle(void) {
+	for (int i = 0; i < SETTLE_PASSES; i++) {
+		uint8_t state = global_state;
+		uint16_t start = substate_start_time;
+		switch_state_serial();
+		select_action();
+		if ((state == global_state) && (start == substate_start_time))
+			break;
+	}
+}
+
+// Record is NULL for lost records (no inputs)
+static void replay_period(const struct sb_trace_record *record, uint8_t encoder_edges) {
+	settle(); // Woken up by TIMER1_CAPT_vect of the previous period
+	if (record) {
+		replay_inputs(record);
+		settle();
+	}
+	wheel_encoder_edges = encoder_edges;
+	GPIOR0 |= _BV(SERVO_OVERFLOW_BIT); // As TIMER1_CAPT_vect does
+	check_timer_overflow();
+	out_buffer_pos = out_buffer_len; // Frame was sent, otherwise the next ones would be dropped
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "Usage: %s [-q] [-c] [-n max_reported] trace\n", name);
+	fprintf(stderr, "  -q  report only summary\n");
+	fprintf(stderr, "  -c  continue after a difference without taking the state from the record\n");
+	fprintf(stderr, "  -n  number of reported differences (default 20, 0 for all)\n");
+}
+
+int main(int argc, char **argv) {
+	struct sb_trace trace;
+	struct sb_trace_record record;
+	const char *path = NULL;
+	unsigned long max_reported = 20;
+	unsigned long records = 0, differences = 0, missing = 0, overflows = 0, resyncs = 0;
+	int quiet = 0;
+	int cascade = 0;
+	uint8_t previous_state;
+	uint16_t previous_start_time;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-q"))
+			quiet = 1;
+		else if (!strcmp(argv[i], "-c"))
+			cascade = 1;
+		else if (!strcmp(argv[i], "-n") && (i + 1 < argc))
+			max_reported = strtoul(argv[++i], NULL, 0);
+		else if ((argv[i][0] != '-') && !path)
+			path = argv[i];
+		else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (!path) {
+		usage(argv[0]);
+		return 2;
+	}
+	if (sb_trace_open(&trace, path) < 0) {
+		perror(path);
+		return 2;
+	}
+
+	ICR1 = SERVO_ICR1;
+	while (sb_trace_next(&trace, &record)) {
+		uint16_t gap = record.time - (uint16_t) (firmware_time + 1);
+		if (records == 0) {
+			firmware_time = record.time - 1;
+			if (record.time != 1) {
+				// Trace does not start at boot, continue in the recorded mode
+				global_state = record.state;
+				substate_start_time = firmware_time;
+				fprintf(stderr, "%s: trace starts at time %u, not at boot\n", path, record.time);
+			}
+		}
+		else if (gap > MAX_LOST_RECORDS) {
+			// Board was restarted or the stream is damaged too much
+			firmware_time = record.time - 1;
+			global_state = record.state;
+			substate_start_time = firmware_time;
+			resyncs++;
+		}
+		else {
+			// Lost records (damaged serial stream), replay empty periods
+			for (; gap > 0; gap--) {
+				replay_period(NULL, wheel_encoder_edges);
+				missing++;
+			}
+		}
+
+		previous_state = global_state;
+		previous_start_time = substate_start_time;
+		replay_period(&record, record.encoder_edges);
+		records++;
+		if (record.flags & (FLIGHT_RECORDER_SERIAL_OVERFLOW | FLIGHT_RECORDER_CAPTURE_OVERFLOW))
+			overflows++;
+
+		if ((OCR1_SPEED != record.speed_us) || (OCR1_ANGLE != record.angle_us) ||
+				(speed_controller_current_state != record.driver_state) || (global_state != record.state)) {
+			differences++;
+			if (!quiet && ((max_reported == 0) || (differences <= max_reported))) {
+				printf("time %5u: mode %02x/%02x speed %5u/%5u angle %5u/%5u driver %02x/%02x (recorded/replayed)\n",
+						record.time,
+						record.state, global_state,
+						record.speed_us, OCR1_SPEED,
+						record.angle_us, OCR1_ANGLE,
+						record.driver_state, speed_controller_current_state);
+			}
+			if (!cascade) {
+				if (global_state != record.state) {
+					// Recorded substate either continues or started in this period
+					substate_start_time = (record.state == previous_state) ? previous_start_time : firmware_time;
+					global_state = record.state;
+				}
+				speed_controller_current_state = record.driver_state;
+				OCR1_SPEED = record.speed_us;
+				OCR1_ANGLE = record.angle_us;
+			}
+		}
+	}
+
+	printf("%lu records, %lu differences, %lu lost records, %lu resyncs, %lu overflows, %zu bytes skipped\n",
+			records, differences, missing, resyncs, overflows, trace.skipped);
+	sb_trace_close(&trace);
+	return differences ? 1 : 0;
+}
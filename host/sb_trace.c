@@ -0,0 +1,106 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sb_trace.h"
+
+int sb_trace_open(struct sb_trace *trace, const char *path) {
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	trace->size = st.st_size;
+	trace->pos = 0;
+	trace->skipped = 0;
+	trace->data = NULL;
+	if (trace->size > 0) {
+		trace->data = mmap(NULL, trace->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (trace->data == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		madvise((void *) trace->data, trace->size, MADV_SEQUENTIAL);
+	}
+	close(fd); // mapping stays valid
+	return 0;
+}
+
+void sb_trace_close(struct sb_trace *trace) {
+	if (trace->data)
+		munmap((void *) trace->data, trace->size);
+	trace->data = NULL;
+	trace->size = 0;
+}
+
+static uint16_t read_u16(const uint8_t *p) {
+	return ((uint16_t) p[0] << 8) | p[1];
+}
+
+// Returns length of valid record at p (with at most avail bytes), or 0
+static size_t parse_record(const uint8_t *p, size_t avail, struct sb_trace_record *record) {
+	size_t len, header;
+	uint8_t sum = 0, sum_of_sums = 0;
+
+	if (avail < FLIGHT_RECORDER_HEADER_LEN + FLIGHT_RECORDER_CHECKSUM_LEN || p[0] != FLIGHT_RECORDER_TAG)
+		return 0;
+	len = p[1];
+	if (len < FLIGHT_RECORDER_HEADER_LEN + FLIGHT_RECORDER_CHECKSUM_LEN || len > FLIGHT_RECORDER_MAX_LEN || len > avail)
+		return 0;
+
+	if ((FLIGHT_RECORDER_SPEED_CAPTURES(p[10]) > FLIGHT_RECORDER_CAPTURE_LOG_SIZE) ||
+			(FLIGHT_RECORDER_ANGLE_CAPTURES(p[10]) > FLIGHT_RECORDER_CAPTURE_LOG_SIZE))
+		return 0;
+	header = FLIGHT_RECORDER_HEADER_LEN;
+	header += 2 * FLIGHT_RECORDER_SPEED_CAPTURES(p[10]);
+	header += 2 * FLIGHT_RECORDER_ANGLE_CAPTURES(p[10]);
+	if (header + FLIGHT_RECORDER_CHECKSUM_LEN > len)
+		return 0;
+
+	for (size_t i = 0; i < len - FLIGHT_RECORDER_CHECKSUM_LEN; i++) {
+		sum += p[i];
+		sum_of_sums += sum;
+	}
+	if ((sum != p[len - 2]) || (sum_of_sums != p[len - 1]))
+		return 0;
+
+	record->time = read_u16(p + 2);
+	record->state = p[4];
+	record->speed_us = read_u16(p + 5);
+	record->angle_us = read_u16(p + 7);
+	record->driver_state = p[9];
+	record->flags = p[10];
+	record->encoder_edges = p[11];
+	header = FLIGHT_RECORDER_HEADER_LEN;
+	record->speed_captures = FLIGHT_RECORDER_SPEED_CAPTURES(record->flags);
+	record->angle_captures = FLIGHT_RECORDER_ANGLE_CAPTURES(record->flags);
+	for (int i = 0; i < record->speed_captures; i++) {
+		record->capture_speed[i] = read_u16(p + header);
+		header += 2;
+	}
+	for (int i = 0; i < record->angle_captures; i++) {
+		record->capture_angle[i] = read_u16(p + header);
+		header += 2;
+	}
+	record->serial = p + header;
+	record->serial_len = len - FLIGHT_RECORDER_CHECKSUM_LEN - header;
+	return len;
+}
+
+int sb_trace_next(struct sb_trace *trace, struct sb_trace_record *record) {
+	while (trace->pos < trace->size) {
+		size_t len = parse_record(trace->data + trace->pos, trace->size - trace->pos, record);
+		if (len) {
+			trace->pos += len;
+			return 1;
+		}
+		trace->pos++;
+		trace->skipped++;
+	}
+	return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef _SB_TRACE_H_
+#define _SB_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../flight_recorder.h"
+
+// Reader of traces recorded from firmware built with FLIGHT_RECORDER. A trace
+// is just the raw serial stream (e.g. `cat /dev/ttyUSB0 > session.sbt`), so
+// it also contains telemetry packets and possibly damaged data. Those are
+// skipped, only records with valid length and checksum are returned.
+//
+// The file is memory-mapped and read sequentially, so traces of any length
+// can be processed without loading them into memory.
+
+struct sb_trace {
+	const uint8_t *data;
+	size_t size;
+	size_t pos;
+	size_t skipped; // bytes not belonging to any valid record
+};
+
+struct sb_trace_record {
+	uint16_t time;
+	uint8_t state;
+	uint16_t speed_us;
+	uint16_t angle_us;
+	uint8_t driver_state;
+	uint8_t flags;
+	uint8_t encoder_edges;
+	uint8_t speed_captures;
+	uint8_t angle_captures;
+	uint16_t capture_speed[FLIGHT_RECORDER_CAPTURE_LOG_SIZE];
+	uint16_t capture_angle[FLIGHT_RECORDER_CAPTURE_LOG_SIZE];
+	const uint8_t *serial;
+	uint8_t serial_len;
+};
+
+int sb_trace_open(struct sb_trace *trace, const char *path);
+void sb_trace_close(struct sb_trace *trace);
+// Returns 1 and fills record if next record was found, 0 at the end of trace
+int sb_trace_next(struct sb_trace *trace, struct sb_trace_record *record);
+
+#endif
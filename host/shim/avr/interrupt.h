@@ -0,0 +1,8 @@
+#ifndef _HOST_AVR_INTERRUPT_H_
+#define _HOST_AVR_INTERRUPT_H_
+
+// There are no interrupts in native builds
+#define cli() do {} while (0)
+#define sei() do {} while (0)
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef _HOST_AVR_IO_H_
+#define _HOST_AVR_IO_H_
+
+// Stand-in for <avr/io.h> used by native builds of the firmware logic. All
+// registers touched by the logic are plain variables (see avr_io.c), so host
+// tools can feed them with recorded values.
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+// USART0
+extern volatile uint8_t UDR0;
+extern volatile uint8_t UCSR0A;
+#define RXC0	7
+#define UDRE0	5
+
+// Timer1
+extern volatile uint16_t TCNT1;
+extern volatile uint16_t ICR1;
+extern volatile uint16_t OCR1A;
+extern volatile uint16_t OCR1B;
+extern volatile uint8_t TIFR1;
+#define ICF1	5
+
+// Timer0, Timer2
+extern volatile uint8_t TCCR0A;
+extern volatile uint8_t TCCR0B;
+extern volatile uint8_t TIMSK0;
+extern volatile uint8_t TCCR2A;
+extern volatile uint8_t TCCR2B;
+extern volatile uint8_t TIMSK2;
+#define CS01	1
+#define CS21	1
+
+// External interrupts
+extern volatile uint8_t EICRA;
+extern volatile uint8_t EIMSK;
+extern volatile uint8_t EIFR;
+#define ISC00	0
+#define ISC01	1
+#define ISC10	2
+#define ISC11	3
+#define INT0	0
+#define INT1	1
+#define INTF0	0
+#define INTF1	1
+
+// GPIO
+extern volatile uint8_t GPIOR0;
+extern volatile uint8_t PORTB;
+extern volatile uint8_t DDRB;
+#define PB5	5
+
+#endif
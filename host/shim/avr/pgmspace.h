@@ -0,0 +1,10 @@
+#ifndef _HOST_AVR_PGMSPACE_H_
+#define _HOST_AVR_PGMSPACE_H_
+
+// Flash and RAM share the same address space in native builds
+#include <string.h>
+
+#define PROGMEM
+#define memcpy_P memcpy
+
+#endif
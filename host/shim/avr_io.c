@@ -0,0 +1,33 @@
+#include <stdint.h>
+#include <avr/io.h>
+
+volatile uint8_t UDR0;
+volatile uint8_t UCSR0A;
+
+volatile uint16_t TCNT1;
+volatile uint16_t ICR1;
+volatile uint16_t OCR1A;
+volatile uint16_t OCR1B;
+volatile uint8_t TIFR1;
+
+volatile uint8_t TCCR0A;
+volatile uint8_t TCCR0B;
+volatile uint8_t TIMSK0;
+volatile uint8_t TCCR2A;
+volatile uint8_t TCCR2B;
+volatile uint8_t TIMSK2;
+
+volatile uint8_t EICRA;
+volatile uint8_t EIMSK;
+volatile uint8_t EIFR;
+
+volatile uint8_t GPIOR0;
+volatile uint8_t PORTB;
+volatile uint8_t DDRB;
+
+// Normally defined in input_capture_asm.S
+volatile uint16_t counter_0;
+volatile uint16_t counter_1;
+
+// Normally defined in wheel_encoder_asm.S
+volatile uint8_t wheel_encoder_edges;
@@ -1,9 +1,16 @@
 #ifndef _HW_H_
 #define _HW_H_
 
+// Pins and timers are selected by target MCU (`make MCU=...`), host build uses the ATmega328P mapping
+
 // Servo signals mapping
+#if SERVO_CHANNELS > 2
+#define OCR1_ANGLE servo_channel_us[0]
+#define OCR1_SPEED servo_channel_us[1]
+#else
 #define OCR1_ANGLE OCR1A
 #define OCR1_SPEED OCR1B
+#endif
 
 // Input capture signals mapping
 #define INPUT_CAPTURE_ANGLE_SINGLE_SHOT input_capture_0_single_shot
@@ -14,4 +21,100 @@
 #define INPUT_CAPTURE_SPEED_RUNNING     input_capture_1_running
 #define COUNTER_SPEED                   counter_1
 
+// Rising edge timestamps, only with INPUT_CAPTURE_HARDWARE
+#define CAPTURE_START_ANGLE             capture_start_0
+#define INPUT_CAPTURE_ANGLE_NOW         input_capture_0_now
+#define CAPTURE_START_SPEED             capture_start_1
+#define INPUT_CAPTURE_SPEED_NOW         input_capture_1_now
+
+#if defined(__AVR_ATmega2560__)
+
+// Servo output pins (channels 0 and 1 are the OC1A/OC1B pins, others are used with SERVO_CHANNELS > 2)
+#define SERVO_MAIN_PORT     PORTB
+#define SERVO_MAIN_DDR      DDRB
+#define SERVO_MAIN_PIN      PINB
+#define SERVO_CHANNEL_0_BIT PB5
+#define SERVO_CHANNEL_1_BIT PB6
+#define SERVO_EXTRA_PORT    PORTC
+#define SERVO_EXTRA_DDR     DDRC
+#define SERVO_EXTRA_PIN     PINC
+#define SERVO_EXTRA_SHIFT   0     // Channel 2 is PC0, channel 3 is PC1, ...
+
+// Input capture units of 16-bit timers, channel 0 is ICP4 (PL0), channel 1 is ICP5 (PL1)
+#define INPUT_CAPTURE_HARDWARE
+#define INPUT_CAPTURE_0_vect  TIMER4_CAPT_vect
+#define INPUT_CAPTURE_0_TCCRA TCCR4A
+#define INPUT_CAPTURE_0_TCCRB TCCR4B
+#define INPUT_CAPTURE_0_TCNT  TCNT4
+#define INPUT_CAPTURE_0_ICRL  ICR4L
+#define INPUT_CAPTURE_0_ICRH  ICR4H
+#define INPUT_CAPTURE_0_TIMSK TIMSK4
+#define INPUT_CAPTURE_0_TIFR  TIFR4
+#define INPUT_CAPTURE_1_vect  TIMER5_CAPT_vect
+#define INPUT_CAPTURE_1_TCCRA TCCR5A
+#define INPUT_CAPTURE_1_TCCRB TCCR5B
+#define INPUT_CAPTURE_1_TCNT  TCNT5
+#define INPUT_CAPTURE_1_ICRL  ICR5L
+#define INPUT_CAPTURE_1_ICRH  ICR5H
+#define INPUT_CAPTURE_1_TIMSK TIMSK5
+#define INPUT_CAPTURE_1_TIFR  TIFR5
+// Bit positions are the same for all 16-bit timers
+#define INPUT_CAPTURE_ICNC    ICNC4 // in TCCRnB
+#define INPUT_CAPTURE_ICES    ICES4 // in TCCRnB
+#define INPUT_CAPTURE_CS1     CS41  // in TCCRnB
+#define INPUT_CAPTURE_ICIE    ICIE4 // in TIMSKn
+#define INPUT_CAPTURE_ICF     ICF4  // in TIFRn
+
+// Wheel encoder input (any pin with pin change interrupt, PK0 = PCINT16)
+#define WHEEL_ENCODER_DDR   DDRK
+#define WHEEL_ENCODER_PORT  PORTK
+#define WHEEL_ENCODER_BIT   PK0
+#define WHEEL_ENCODER_PCMSK PCMSK2
+#define WHEEL_ENCODER_PCIE  PCIE2
+#define WHEEL_ENCODER_PCIF  PCIF2
+#define WHEEL_ENCODER_vect  PCINT2_vect
+
+// Onboard LED
+#define LED_DDR  DDRB
+#define LED_PORT PORTB
+#define LED_BIT  PB7
+
+// Serial line interrupts (USART0)
+#define SERIAL_RX_vect   USART0_RX_vect
+#define SERIAL_UDRE_vect USART0_UDRE_vect
+
+#else // ATmega328P
+
+// Servo output pins (channels 0 and 1 are the OC1A/OC1B pins, others are used with SERVO_CHANNELS > 2)
+#define SERVO_MAIN_PORT     PORTB
+#define SERVO_MAIN_DDR      DDRB
+#define SERVO_MAIN_PIN      PINB
+#define SERVO_CHANNEL_0_BIT PB1
+#define SERVO_CHANNEL_1_BIT PB2
+#define SERVO_EXTRA_PORT    PORTC
+#define SERVO_EXTRA_DDR     DDRC
+#define SERVO_EXTRA_PIN     PINC
+#define SERVO_EXTRA_SHIFT   0     // Channel 2 is PC0, channel 3 is PC1, ...
+
+// Input capture uses INT0 (PD2) and INT1 (PD3) with Timer0 and Timer2 (see input_capture_asm.S)
+
+// Wheel encoder input (any pin with pin change interrupt, PD4 = PCINT20)
+#define WHEEL_ENCODER_DDR   DDRD
+#define WHEEL_ENCODER_PORT  PORTD
+#define WHEEL_ENCODER_BIT   PD4
+#define WHEEL_ENCODER_PCMSK PCMSK2
+#define WHEEL_ENCODER_PCIE  PCIE2
+#define WHEEL_ENCODER_PCIF  PCIF2
+#define WHEEL_ENCODER_vect  PCINT2_vect
+
+// Onboard LED
+#define LED_DDR  DDRB
+#define LED_PORT PORTB
+#define LED_BIT  PB5
+
+// Serial line interrupts (USART0)
+#define SERIAL_RX_vect   USART_RX_vect
+#define SERIAL_UDRE_vect USART_UDRE_vect
+
+#endif
 #endif
@@ -3,6 +3,85 @@
 #include <stdint.h>
 #include <avr/interrupt.h>
 #include "input_capture.h"
+#include "hw.h"
+
+struct capture_filter_config capture_filter_config = {
+	700,  // minimal plausible pulse width (us)
+	2300, // maximal plausible pulse width (us)
+	3,    // dropout: 50 Hz receivers leave every second period empty
+};
+
+#ifdef INPUT_CAPTURE_HARDWARE
+
+// Timers are running all the time, both edges are timestamped by input capture units
+void input_capture_init(void) {
+	INPUT_CAPTURE_0_TCCRA = 0;           // Initial value, Normal mode
+	INPUT_CAPTURE_0_TCCRB = _BV(INPUT_CAPTURE_ICNC) | _BV(INPUT_CAPTURE_CS1); // Noise canceler, clk / 8 (--> 16 MHz / 8 = 2 MHz clock)
+	INPUT_CAPTURE_0_TIMSK = 0;           // Initial value, Input Capture Interrupt Disable
+
+	INPUT_CAPTURE_1_TCCRA = 0;           // Initial value, Normal mode
+	INPUT_CAPTURE_1_TCCRB = _BV(INPUT_CAPTURE_ICNC) | _BV(INPUT_CAPTURE_CS1); // Noise canceler, clk / 8 (--> 16 MHz / 8 = 2 MHz clock)
+	INPUT_CAPTURE_1_TIMSK = 0;           // Initial value, Input Capture Interrupt Disable
+}
+
+void input_capture_0_single_shot(void) {
+	if (INPUT_CAPTURE_0_TIMSK & _BV(INPUT_CAPTURE_ICIE))
+		return; // Capture is already running, do nothing
+	cli();
+	INPUT_CAPTURE_0_TCCRB |= _BV(INPUT_CAPTURE_ICES); // Capture rising edge
+	GPIOR0 &= ~_BV(0);                   // Clear bit in GPIOR0 -- detecting rising edge
+	INPUT_CAPTURE_0_TIFR = _BV(INPUT_CAPTURE_ICF); // Clear input capture flag
+	INPUT_CAPTURE_0_TIMSK |= _BV(INPUT_CAPTURE_ICIE); // Enable input capture interrupt
+	sei();
+}
+
+uint8_t input_capture_0_running(void) {
+	return !!(INPUT_CAPTURE_0_TIMSK & _BV(INPUT_CAPTURE_ICIE));
+}
+
+void input_capture_1_single_shot(void) {
+	if (INPUT_CAPTURE_1_TIMSK & _BV(INPUT_CAPTURE_ICIE))
+		return; // Capture is already running, do nothing
+	cli();
+	INPUT_CAPTURE_1_TCCRB |= _BV(INPUT_CAPTURE_ICES); // Capture rising edge
+	GPIOR0 &= ~_BV(1);                   // Clear bit in GPIOR0 -- detecting rising edge
+	INPUT_CAPTURE_1_TIFR = _BV(INPUT_CAPTURE_ICF); // Clear input capture flag
+	INPUT_CAPTURE_1_TIMSK |= _BV(INPUT_CAPTURE_ICIE); // Enable input capture interrupt
+	sei();
+}
+
+uint8_t input_capture_1_running(void) {
+	return !!(INPUT_CAPTURE_1_TIMSK & _BV(INPUT_CAPTURE_ICIE));
+}
+
+// 16-bit timer registers share TEMP register with ICRn read by interrupt
+uint16_t input_capture_0_now(void) {
+	uint16_t value;
+	cli();
+	value = INPUT_CAPTURE_0_TCNT;
+	sei();
+	return value;
+}
+
+uint16_t input_capture_1_now(void) {
+	uint16_t value;
+	cli();
+	value = INPUT_CAPTURE_1_TCNT;
+	sei();
+	return value;
+}
+
+void input_capture_deinit(void) {
+	INPUT_CAPTURE_0_TIMSK = 0;           // Initial value, Input Capture Interrupt Disable
+	INPUT_CAPTURE_0_TCCRA = 0;           // Initial value
+	INPUT_CAPTURE_0_TCCRB = 0;           // Initial value
+
+	INPUT_CAPTURE_1_TIMSK = 0;           // Initial value, Input Capture Interrupt Disable
+	INPUT_CAPTURE_1_TCCRA = 0;           // Initial value
+	INPUT_CAPTURE_1_TCCRB = 0;           // Initial value
+}
+
+#else
 
 void input_capture_init(void) {
 	TCCR0A = 0;                          // Initial value
@@ -54,8 +133,96 @@ void input_capture_deinit(void) {
 	TCCR2B = 0;                          // Initial value
 }
 
+#endif
+
+// Time from last_start to `time`, which can be slightly before last_check
+// (rising edge came before the last check, pulse was processed after it)
+static uint16_t capture_period_elapsed(const struct capture_period *check, uint16_t time) {
+	int32_t elapsed = (int32_t) check->elapsed + (int16_t) (time - check->last_check);
+	if (elapsed < 0)
+		return 0;
+	if (elapsed > 0xFFFF)
+		return 0xFFFF;
+	return elapsed;
+}
+
+// Call for each accepted pulse with timestamp of its rising edge
+void capture_period_push(struct capture_period *check, uint16_t start) {
+	if (check->valid) {
+		uint16_t interval = capture_period_elapsed(check, start);
+		if ((interval >= CAPTURE_PERIOD_MIN) && (interval <= CAPTURE_PERIOD_MAX))
+			check->period = interval;
+	}
+	check->last_start = start;
+	check->last_check = start;
+	check->elapsed = 0;
+	check->valid = 1;
+	check->late = 0;
+}
+
+// Call once in each period of Timer1, so the timer does not wrap around between calls
+uint8_t capture_period_late(struct capture_period *check, uint16_t now) {
+	if (!check->valid)
+		return check->late;
+	check->elapsed = capture_period_elapsed(check, now);
+	check->last_check = now;
+	if (check->period && (check->elapsed > check->period + (check->period >> 2))) {
+		// Period is measured again from the next two pulses
+		check->late = 1;
+		check->valid = 0;
+		check->period = 0;
+	}
+	return check->late;
+}
+
+// Input lost, start from scratch
+void capture_period_reset(struct capture_period *check) {
+	check->valid = 0;
+	check->period = 0;
+	check->late = 0;
+}
+
 uint16_t convert_raw_counter_to_us(uint16_t counter) {
 	// Self calibartion showed, that we sometimes report (correct value - 1).
 	// We need to divide raw counter value by two, so we are going to round it up.
 	return (counter + 1) >> 1;
 }
+
+uint16_t median_of_three(uint16_t a, uint16_t b, uint16_t c) {
+	uint16_t tmp;
+	if (a > b) {
+		tmp = a;
+		a = b;
+		b = tmp;
+	}
+	// a <= b
+	if (c < a)
+		return a;
+	if (c > b)
+		return b;
+	return c;
+}
+
+// Returns filtered pulse width in us or 0, if the pulse was rejected
+uint16_t capture_filter_push(struct capture_filter *filter, uint16_t width_us) {
+	if ((width_us < capture_filter_config.min_us) || (width_us > capture_filter_config.max_us)) {
+		// Noise on the signal line, or two pulses merged together
+		filter->rejected++;
+		return 0;
+	}
+
+	filter->history[filter->pos] = width_us;
+	filter->pos = (filter->pos + 1) % CAPTURE_FILTER_LENGTH;
+	if (filter->count < CAPTURE_FILTER_LENGTH) {
+		// Not enough data for median yet
+		filter->count++;
+		return width_us;
+	}
+	// Single glitch is removed, real change of the signal passes with one period delay
+	return median_of_three(filter->history[0], filter->history[1], filter->history[2]);
+}
+
+// Forget old values (e.g. after the signal was lost)
+void capture_filter_reset(struct capture_filter *filter) {
+	filter->count = 0;
+}
@@ -16,4 +16,49 @@ extern volatile uint16_t counter_1;
 
 uint16_t convert_raw_counter_to_us(uint16_t counter);
 
+// Only with hardware timestamps (INPUT_CAPTURE_HARDWARE in hw.h)
+extern volatile uint16_t capture_start_0; // rising edge of the last pulse
+extern volatile uint16_t capture_start_1;
+uint16_t input_capture_0_now(void);       // current value of the same timer
+uint16_t input_capture_1_now(void);
+
+// Receiver period check: next pulse is late, if its rising edge does not come
+// within 1.25 receiver period from the previous one (timestamps in 0.5 us)
+#define CAPTURE_PERIOD_MIN 10000 // 5 ms, shorter intervals are not a receiver period
+#define CAPTURE_PERIOD_MAX 50000 // 25 ms (40 Hz receivers), 1.25 of it still fits into 16 bits
+
+struct capture_period {
+	uint16_t last_start; // rising edge of the last accepted pulse
+	uint16_t last_check; // timer value of the last capture_period_late() (or last_start)
+	uint16_t elapsed;    // from last_start to last_check, saturated (timer wraps around in 32.8 ms)
+	uint16_t period;     // last plausible interval between rising edges (0 = unknown)
+	uint8_t valid;       // last_start is valid (cleared when the next pulse is late)
+	uint8_t late;        // next pulse is late, stays set until it comes
+};
+
+void capture_period_push(struct capture_period *check, uint16_t start);
+uint8_t capture_period_late(struct capture_period *check, uint16_t now);
+void capture_period_reset(struct capture_period *check);
+
+// Validation of measured pulses: plausible width window and median of last three
+#define CAPTURE_FILTER_LENGTH 3
+
+struct capture_filter_config {
+	uint16_t min_us; // shorter pulses are rejected
+	uint16_t max_us; // longer pulses are rejected
+	uint8_t dropout_periods; // no accepted pulse for so many periods is dropout (without known receiver period)
+};
+
+struct capture_filter {
+	uint16_t history[CAPTURE_FILTER_LENGTH];
+	uint8_t pos;
+	uint8_t count;    // number of valid values in history
+	uint8_t rejected; // number of rejected pulses (wraps around)
+};
+
+extern struct capture_filter_config capture_filter_config;
+
+uint16_t capture_filter_push(struct capture_filter *filter, uint16_t width_us);
+void capture_filter_reset(struct capture_filter *filter);
+
 #endif
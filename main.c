@@ -2,14 +2,23 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <util/delay.h>
+#include <avr/pgmspace.h>
+#include <string.h>
 #include "servo.h"
 #include "uart.h"
 #include "input_capture.h"
 #include "hw.h"
 #include "speed_controller.h"
 #include "sb_states.h"
-
-#define INPUT_CAPTURE_TIMEOUT	10
+#include "flight_recorder.h"
+#include "wheel_encoder.h"
+#include "speed_loop.h"
+#include "failsafe.h"
+#include "scheduler.h"
+#include "curve.h"
+#include "registers.h"
+
+#define INPUT_CAPTURE_TIMEOUT	4 // Apx. three receiver pulses missing
 #define SERIAL_MODES_TIMEOUT	1000
 
 // Global state of whole system
@@ -24,17 +33,44 @@ uint16_t capture_speed_us = 0;
 uint16_t capture_angle_us = 0;
 uint8_t capture_speed_data_age = 0xFF;
 uint8_t capture_angle_data_age = 0xFF;
+struct capture_filter capture_speed_filter;
+struct capture_filter capture_angle_filter;
+uint8_t capture_dropout = 0; // Treated as input timeout by mode engine
+#ifdef INPUT_CAPTURE_HARDWARE
+struct capture_period capture_speed_period;
+struct capture_period capture_angle_period;
+#endif
+
+#define CAPTURE_DROPOUT_SPEED	0x01
+#define CAPTURE_DROPOUT_ANGLE	0x02
 
 void manage_input_capture(void) {
+	uint16_t width_us;
 	// If measurement is not running, save the result and , start new one
 	if (! INPUT_CAPTURE_SPEED_RUNNING()) {
-		capture_speed_us = convert_raw_counter_to_us(COUNTER_SPEED);
-		capture_speed_data_age = 0;
+		flight_recorder_log_capture(FLIGHT_RECORDER_CAPTURE_SPEED, COUNTER_SPEED);
+		width_us = capture_filter_push(&capture_speed_filter, convert_raw_counter_to_us(COUNTER_SPEED));
+		if (width_us) {
+			capture_speed_us = width_us;
+			capture_speed_data_age = 0;
+			capture_dropout &= ~CAPTURE_DROPOUT_SPEED;
+#ifdef INPUT_CAPTURE_HARDWARE
+			capture_period_push(&capture_speed_period, CAPTURE_START_SPEED);
+#endif
+		}
 		INPUT_CAPTURE_SPEED_SINGLE_SHOT();
 	}
 	if (! INPUT_CAPTURE_ANGLE_RUNNING()) {
-		capture_angle_us = convert_raw_counter_to_us(COUNTER_ANGLE);
-		capture_angle_data_age = 0;
+		flight_recorder_log_capture(FLIGHT_RECORDER_CAPTURE_ANGLE, COUNTER_ANGLE);
+		width_us = capture_filter_push(&capture_angle_filter, convert_raw_counter_to_us(COUNTER_ANGLE));
+		if (width_us) {
+			capture_angle_us = width_us;
+			capture_angle_data_age = 0;
+			capture_dropout &= ~CAPTURE_DROPOUT_ANGLE;
+#ifdef INPUT_CAPTURE_HARDWARE
+			capture_period_push(&capture_angle_period, CAPTURE_START_ANGLE);
+#endif
+		}
 		INPUT_CAPTURE_ANGLE_SINGLE_SHOT();
 	}
 }
@@ -45,44 +81,107 @@ uint16_t serial_angle_us = 0;
 uint8_t serial_set_mode = 0;
 uint8_t serial_timeout = 0;
 uint16_t serial_data_age = 0xFFFF;
-unsigned char in_buffer[12];
+uint16_t serial_target_speed = 0;
+uint8_t speed_loop_in_control = 0;
+#if SERVO_CHANNELS > 2
+uint16_t serial_channel_us[SERVO_CHANNELS]; // Extra channels, 0 = keep current value
+uint8_t serial_channels_pending = 0;
+#endif
+unsigned char in_buffer[REGISTERS_REQUEST_MAX_LEN];
 int in_buffer_len = 0;
 
+// Length of packet in in_buffer, 0 if it is not known yet, 0xFF if the packet is invalid
+uint8_t in_packet_length(void) {
+	switch (in_buffer[0]) {
+		case 'B':
+			return 9;
+#if SERVO_CHANNELS > 2
+		case 'C':
+			return 13;
+#endif
+		case 'V':
+		case 'W':
+			return registers_request_length(in_buffer, in_buffer_len);
+		default:
+			return REGISTERS_INVALID;
+	}
+}
+
 void uart_input_tick(void) {
+	uint8_t length;
+
 	if (! UART_INPUT_READY)
 		return;
 
 	in_buffer[in_buffer_len] = UDR0;
+	flight_recorder_log_serial(in_buffer[in_buffer_len]);
 	in_buffer_len++;
 
-	if (in_buffer_len == 1) {
-		if (in_buffer[0] != 'B') {
-			// First byte incorrect, flush buffer
-			in_buffer_len = 0;
-		}
-	}
-	else if (in_buffer_len == 9) {
-		// reserved, must be 0 in current protocol version
-		if (in_buffer[7] != 0)
-			return;
-		if (in_buffer[8] != 0)
-			return;
-
-		// load data from packet
-		serial_speed_us = in_buffer[1] | ((uint16_t) in_buffer[2]) << 8;
-		serial_angle_us = in_buffer[3] | ((uint16_t) in_buffer[4]) << 8;
-		serial_set_mode = in_buffer[5];
-		serial_timeout = in_buffer[6];
-		serial_data_age = 0;
-
-		// clear buffer
+	length = in_packet_length();
+	if (length == REGISTERS_INVALID) {
+		// First byte incorrect, flush buffer
 		in_buffer_len = 0;
-
+		return;
+	}
+	if ((length == REGISTERS_INCOMPLETE) || (in_buffer_len < length))
+		return; // Wait for the rest of the packet
+
+	switch (in_buffer[0]) {
+		case 'B':
+			// load data from packet
+			serial_speed_us = in_buffer[1] | ((uint16_t) in_buffer[2]) << 8;
+			serial_angle_us = in_buffer[3] | ((uint16_t) in_buffer[4]) << 8;
+			serial_set_mode = in_buffer[5];
+			serial_timeout = in_buffer[6];
+			// Bytes 7 and 8 were reserved (packets with non-zero ones were
+			// ignored), now they carry the target speed of the closed loop
+			// (zero keeps the loop disabled, so old senders work as before)
+			serial_target_speed = in_buffer[7] | ((uint16_t) in_buffer[8]) << 8;
+			serial_data_age = 0;
+			break;
+#if SERVO_CHANNELS > 2
+		case 'C':
+			// Extra servo channels 2 to 7
+			for (uint8_t channel = 2; channel < 8; channel++) {
+				if (channel < SERVO_CHANNELS)
+					serial_channel_us[channel] = in_buffer[2 * channel - 3] | ((uint16_t) in_buffer[2 * channel - 2]) << 8;
+			}
+			serial_channels_pending = 1;
+			break;
+#endif
+		case 'V':
+			registers_request(in_buffer);
+			break;
+		case 'W':
+			registers_stream(in_buffer);
+			break;
 	}
+
+	// clear buffer
+	in_buffer_len = 0;
 }
 
 // Output to serial line
-unsigned char out_buffer [32];
+// Frame of each period (telemetry, extra channels, flight recorder record and
+// register replies) has to be sent before the next one, so it is limited to
+// the bytes UART sends during one period. Register replies which do not fit
+// are deferred.
+#define OUT_PERIOD_LEN    (UART_BYTES_PER_SECOND * 2 * SERVO_ICR1 / 2000000) // 116 bytes
+#define OUT_TELEMETRY_LEN 27
+#if SERVO_CHANNELS > 2
+#define OUT_CHANNELS_LEN  (2 * (SERVO_CHANNELS - 2))
+#else
+#define OUT_CHANNELS_LEN  0
+#endif
+#ifdef FLIGHT_RECORDER
+#define OUT_RECORD_LEN    FLIGHT_RECORDER_MAX_LEN
+#else
+#define OUT_RECORD_LEN    0
+#endif
+_Static_assert(OUT_TELEMETRY_LEN + OUT_CHANNELS_LEN + OUT_RECORD_LEN + REGISTERS_REPLY_MAX_LEN <= OUT_PERIOD_LEN,
+		"Reply to 'V' has to fit into each frame");
+
+unsigned char out_buffer [2 * OUT_PERIOD_LEN]; // Unsent rest of the previous frame and the new one
 int out_buffer_pos = 0;
 int out_buffer_len = 0;
 
@@ -96,6 +195,57 @@ void uart_output_tick(void) {
 	}
 }
 
+// Appends frame of this period after the unsent rest of out_buffer
+void write_frame(void) {
+	unsigned char *frame;
+	uint8_t len;
+
+	out_buffer_len -= out_buffer_pos;
+	memmove(out_buffer, out_buffer + out_buffer_pos, out_buffer_len);
+	out_buffer_pos = 0;
+	frame = out_buffer + out_buffer_len;
+
+	frame[0] = 'S';
+	frame[1] = global_state;
+	frame[2] = (OCR1_SPEED >> 8);
+	frame[3] = OCR1_SPEED;
+	frame[4] = (OCR1_ANGLE >> 8);
+	frame[5] = OCR1_ANGLE;
+	frame[6] = (capture_speed_us >> 8);
+	frame[7] = capture_speed_us;
+	frame[8] = (capture_angle_us >> 8);
+	frame[9] = capture_angle_us;
+	frame[10] = (time >> 8);
+	frame[11] = time;
+	frame[12] = speed_controller_current_state;
+	frame[13] = capture_speed_data_age;
+	frame[14] = capture_angle_data_age;
+	frame[15] = (serial_data_age >> 8);
+	frame[16] = serial_data_age;
+	frame[17] = (debug >> 8);
+	frame[18] = debug;
+	frame[19] = (speed_loop_speed >> 8);
+	frame[20] = speed_loop_speed;
+	frame[21] = failsafe_reason;
+	frame[22] = (failsafe_start_time >> 8);
+	frame[23] = failsafe_start_time;
+	frame[24] = capture_speed_filter.rejected;
+	frame[25] = capture_angle_filter.rejected;
+	frame[26] = capture_dropout;
+	len = OUT_TELEMETRY_LEN;
+#if SERVO_CHANNELS > 2
+	for (uint8_t channel = 2; channel < SERVO_CHANNELS; channel++) {
+		frame[len++] = (servo_channel_us[channel] >> 8);
+		frame[len++] = servo_channel_us[channel];
+	}
+#endif
+#ifdef FLIGHT_RECORDER
+	len += flight_recorder_write(frame + len, time, global_state, OCR1_SPEED, OCR1_ANGLE, speed_controller_current_state, wheel_encoder_edges);
+#endif
+	len += registers_write_replies(frame + len, OUT_PERIOD_LEN - len);
+	out_buffer_len += len;
+}
+
 // 100 Hz tasks
 void check_timer_overflow() {
 	if (!SERVO_OVERFLOW)
@@ -105,37 +255,63 @@ void check_timer_overflow() {
 	time++;
 	// All overflow tasks
 	speed_controller_simulate_state(OCR1_SPEED);
-
-	out_buffer[0] = 'S';
-	out_buffer[1] = global_state;
-	out_buffer[2] = (OCR1_SPEED >> 8);
-	out_buffer[3] = OCR1_SPEED;
-	out_buffer[4] = (OCR1_ANGLE >> 8);
-	out_buffer[5] = OCR1_ANGLE;
-	out_buffer[6] = (capture_speed_us >> 8);
-	out_buffer[7] = capture_speed_us;
-	out_buffer[8] = (capture_angle_us >> 8);
-	out_buffer[9] = capture_angle_us;
-	out_buffer[10] = (time >> 8);
-	out_buffer[11] = time;
-	out_buffer[12] = speed_controller_current_state;
-	out_buffer[13] = capture_speed_data_age;
-	out_buffer[14] = capture_angle_data_age;
-	out_buffer[15] = (serial_data_age >> 8);
-	out_buffer[16] = serial_data_age;
-	out_buffer[17] = (debug >> 8);
-	out_buffer[18] = debug;
-	out_buffer_len = 19;
-	out_buffer_pos = 0;
+	speed_loop_sample(wheel_encoder_edges);
+	if (speed_loop_in_control)
+		speed_loop_update(serial_target_speed);
+	else
+		speed_loop_reset(); // Do not integrate error, when the output is not used
+	speed_loop_in_control = 0;
+
+	// Dropout: no pulse for capture_filter_config.dropout_periods periods, with
+	// hardware timestamps and known receiver period the next rising edge is late
+	capture_dropout = 0;
+#ifdef INPUT_CAPTURE_HARDWARE
+	if (capture_period_late(&capture_speed_period, INPUT_CAPTURE_SPEED_NOW()) ||
+			(!capture_speed_period.period && (capture_speed_data_age >= capture_filter_config.dropout_periods)))
+		capture_dropout |= CAPTURE_DROPOUT_SPEED;
+	if (capture_period_late(&capture_angle_period, INPUT_CAPTURE_ANGLE_NOW()) ||
+			(!capture_angle_period.period && (capture_angle_data_age >= capture_filter_config.dropout_periods)))
+		capture_dropout |= CAPTURE_DROPOUT_ANGLE;
+#else
+	if (capture_speed_data_age >= capture_filter_config.dropout_periods)
+		capture_dropout |= CAPTURE_DROPOUT_SPEED;
+	if (capture_angle_data_age >= capture_filter_config.dropout_periods)
+		capture_dropout |= CAPTURE_DROPOUT_ANGLE;
+#endif
+	// Previous frame has to be sent first, frame is dropped if the link is
+	// stalled (more than a whole period behind)
+	if (out_buffer_len - out_buffer_pos <= OUT_PERIOD_LEN)
+		write_frame();
 
 	if (capture_speed_data_age < 0xFF)
 		capture_speed_data_age++;
 	if (capture_angle_data_age < 0xFF)
 		capture_angle_data_age++;
+	if (capture_speed_data_age == INPUT_CAPTURE_TIMEOUT) {
+		capture_filter_reset(&capture_speed_filter); // Signal lost, start from scratch
+#ifdef INPUT_CAPTURE_HARDWARE
+		capture_period_reset(&capture_speed_period);
+#endif
+	}
+	if (capture_angle_data_age == INPUT_CAPTURE_TIMEOUT) {
+		capture_filter_reset(&capture_angle_filter);
+#ifdef INPUT_CAPTURE_HARDWARE
+		capture_period_reset(&capture_angle_period);
+#endif
+	}
 	if (serial_data_age < 0xFFFF)
 		serial_data_age++;
 }
 
+// Speed command from serial line, either direct or from the closed loop
+uint16_t serial_speed_state(void) {
+	if (serial_target_speed & SPEED_LOOP_ENABLE) {
+		speed_loop_in_control = 1;
+		return speed_loop_speed_state;
+	}
+	return serial_speed_us;
+}
+
 void switch_state_serial(void) {
 	if ((serial_data_age < 2) && ((global_state & SB_MASK) != (serial_set_mode & SB_MASK))) {
 		global_state = serial_set_mode;
@@ -149,267 +325,326 @@ void switch_to_substate(uint8_t substate) {
 	substate_start_time = time;
 }
 
+/*
+ * Mode engine
+ *
+ * Behaviour of each mode is described by rows of mode_rows table. In each pass
+ * we evaluate all conditions once, then go through rows of current mode and
+ * use the first one, whose substate and guard matches. Row selects source of
+ * steering and throttle and next substate.
+ *
+ * Guard matches if all conditions from `all` are true and at least one of
+ * `any` is true (empty `any` is always true). Condition bits of input
+ * timeouts are the same as failsafe reasons, so failsafe action reports those
+ * from `any` which are true.
+ *
+ * Worst case is given by the longest mode, mode_engine_max_rows and
+ * mode_engine_max_cycles keep the longest pass seen.
+ */
+
+// Conditions
+#define COND_SERIAL_TIMEOUT        FAILSAFE_SERIAL        // No valid packet within timeout given by the packet
+#define COND_CAPTURE_SPEED_TIMEOUT FAILSAFE_CAPTURE_SPEED // Receiver signal lost or pulse missing (dropout)
+#define COND_CAPTURE_ANGLE_TIMEOUT FAILSAFE_CAPTURE_ANGLE
+#define COND_SERIAL_MODES_TIMEOUT  0x0008 // Serial line is dead, return to SB_DEFAULT_STATE
+#define COND_THROTTLE_FORWARD      0x0010 // Remote throttle state
+#define COND_THROTTLE_BACKWARD     0x0020
+#define COND_THROTTLE_NEUTRAL      0x0040
+#define COND_ELAPSED_5             0x0080 // We are in current substate for more than (5 * 10) ms
+#define COND_ELAPSED_200           0x0100
+#define COND_ELAPSED_300           0x0200
+
+#define COND_INPUT_TIMEOUTS        (COND_SERIAL_TIMEOUT | COND_CAPTURE_SPEED_TIMEOUT | COND_CAPTURE_ANGLE_TIMEOUT)
+#define COND_CAPTURE_TIMEOUTS      (COND_CAPTURE_SPEED_TIMEOUT | COND_CAPTURE_ANGLE_TIMEOUT)
+#define COND_THROTTLE_PRESSED      (COND_THROTTLE_FORWARD | COND_THROTTLE_BACKWARD)
+
+// Steering sources
+#define ANGLE_KEEP          0 // Do not change
+#define ANGLE_CAPTURE       1 // Receiver pass-through
+#define ANGLE_SERIAL        2 // Serial line (trimmed by receiver in modes with MODE_TRIM)
+
+// Throttle sources
+#define SPEED_KEEP          0 // Do not change
+#define SPEED_NEUTRAL       1
+#define SPEED_CAPTURE       2 // Receiver pass-through
+#define SPEED_CAPTURE_STATE 3 // Receiver, enforce backward
+#define SPEED_SERIAL        4 // Serial line (or closed loop)
+#define SPEED_SERIAL_LIMIT  5 // Serial line, limited by receiver
+#define SPEED_FORWARD       6 // Full forward
+#define SPEED_BACKWARD      7 // Full backward
+#define SPEED_BRAKE         8 // Full brake
+#define SPEED_FAILSAFE      9 // Failsafe profile (see failsafe.c)
+
+// Next substate
+#define NEXT_STAY           0xFF
+#define NEXT_DEFAULT_MODE   0xFE // Switch to SB_DEFAULT_STATE
+#define SUBSTATE_ANY        0xFF
+
+// Mode flags
+#define MODE_TRIM           0x01 // Add receiver steering to serial steering
+
+struct mode_row {
+	uint8_t substate;
+	uint16_t all;
+	uint16_t any;
+	uint8_t angle;
+	uint8_t speed;
+	uint8_t next;
+};
+
+struct mode_desc {
+	uint8_t first_row;
+	uint8_t rows;
+	uint8_t flags;
+};
+
+const struct mode_row mode_rows[] PROGMEM = {
+	// SB_BOOT: wait first three seconds
+#define ROWS_BOOT 0
+	{SUBSTATE_ANY, COND_ELAPSED_300, 0, ANGLE_KEEP, SPEED_NEUTRAL, NEXT_DEFAULT_MODE},
+	{SUBSTATE_ANY, 0, 0, ANGLE_KEEP, SPEED_NEUTRAL, NEXT_STAY},
+
+	// SB_REMOTE_ONLY
+#define ROWS_REMOTE_ONLY 2
+	{SUBSTATE_ANY, 0, COND_CAPTURE_SPEED_TIMEOUT, ANGLE_CAPTURE, SPEED_FAILSAFE, NEXT_STAY},
+	{SUBSTATE_ANY, 0, 0, ANGLE_CAPTURE, SPEED_CAPTURE, NEXT_STAY},
+
+	// SB_REMOTE_STATE_DEMO
+#define ROWS_REMOTE_STATE_DEMO 4
+	{SUBSTATE_ANY, 0, COND_CAPTURE_SPEED_TIMEOUT, ANGLE_CAPTURE, SPEED_FAILSAFE, NEXT_STAY},
+	{SUBSTATE_ANY, COND_THROTTLE_FORWARD, 0, ANGLE_CAPTURE, SPEED_FORWARD, NEXT_STAY},
+	{SUBSTATE_ANY, COND_THROTTLE_BACKWARD, 0, ANGLE_CAPTURE, SPEED_BACKWARD, NEXT_STAY},
+	{SUBSTATE_ANY, 0, 0, ANGLE_CAPTURE, SPEED_BRAKE, NEXT_STAY},
+
+	// SB_SERIAL_ONLY
+#define ROWS_SERIAL_ONLY 8
+	{SUBSTATE_ANY, COND_SERIAL_MODES_TIMEOUT, COND_SERIAL_TIMEOUT, ANGLE_KEEP, SPEED_FAILSAFE, NEXT_DEFAULT_MODE}, // Failsafe continues
+	{SUBSTATE_ANY, 0, COND_SERIAL_TIMEOUT, ANGLE_SERIAL, SPEED_FAILSAFE, NEXT_STAY},
+	{SUBSTATE_ANY, 0, 0, ANGLE_SERIAL, SPEED_SERIAL, NEXT_STAY},
+
+	// SB_TAKEOVER, SB_TAKEOVER_WITH_TRIM
+	// Substate 0: serial line in control, 1: remote action detected, 2: remote in control
+#define ROWS_TAKEOVER 11
+	{SUBSTATE_ANY, COND_SERIAL_MODES_TIMEOUT, COND_CAPTURE_TIMEOUTS, ANGLE_KEEP, SPEED_FAILSAFE, NEXT_DEFAULT_MODE}, // Failsafe continues
+	{SUBSTATE_ANY, COND_SERIAL_MODES_TIMEOUT, 0, ANGLE_CAPTURE, SPEED_CAPTURE_STATE, NEXT_DEFAULT_MODE}, // Remote stays in control
+	{SUBSTATE_ANY, 0, COND_CAPTURE_TIMEOUTS, ANGLE_SERIAL, SPEED_FAILSAFE, NEXT_STAY},
+	{0, 0, COND_THROTTLE_PRESSED | COND_SERIAL_TIMEOUT, ANGLE_CAPTURE, SPEED_CAPTURE_STATE, 1},
+	{SUBSTATE_ANY, COND_ELAPSED_5, COND_THROTTLE_PRESSED | COND_SERIAL_TIMEOUT, ANGLE_CAPTURE, SPEED_CAPTURE_STATE, 2}, // Restarts the timer in 2
+	{SUBSTATE_ANY, 0, COND_THROTTLE_PRESSED | COND_SERIAL_TIMEOUT, ANGLE_CAPTURE, SPEED_CAPTURE_STATE, NEXT_STAY},
+	{2, COND_ELAPSED_200, 0, ANGLE_CAPTURE, SPEED_CAPTURE_STATE, 0}, // Released for two seconds, return to serial
+	{2, 0, 0, ANGLE_CAPTURE, SPEED_CAPTURE_STATE, NEXT_STAY},
+	{1, 0, 0, ANGLE_SERIAL, SPEED_SERIAL, 0}, // Just for a few measurements, return to serial immediatelly
+	{0, 0, 0, ANGLE_SERIAL, SPEED_SERIAL, NEXT_STAY},
+
+	// SB_SPEED_LIMIT
+#define ROWS_SPEED_LIMIT 21
+	{SUBSTATE_ANY, COND_SERIAL_MODES_TIMEOUT, COND_SERIAL_TIMEOUT, ANGLE_KEEP, SPEED_FAILSAFE, NEXT_DEFAULT_MODE}, // Failsafe continues
+	{SUBSTATE_ANY, 0, COND_INPUT_TIMEOUTS, ANGLE_SERIAL, SPEED_FAILSAFE, NEXT_STAY},
+	{SUBSTATE_ANY, COND_THROTTLE_FORWARD, 0, ANGLE_SERIAL, SPEED_SERIAL_LIMIT, NEXT_STAY},
+	{SUBSTATE_ANY, 0, 0, ANGLE_SERIAL, SPEED_NEUTRAL, NEXT_STAY},
+
+	// SB_PAUSE (see DEVEL.md for description of substates)
+#define ROWS_PAUSE 25
+	{SUBSTATE_ANY, COND_SERIAL_MODES_TIMEOUT, COND_SERIAL_TIMEOUT, ANGLE_KEEP, SPEED_FAILSAFE, NEXT_DEFAULT_MODE}, // Failsafe continues
+	{SUBSTATE_ANY, 0, COND_INPUT_TIMEOUTS, ANGLE_SERIAL, SPEED_FAILSAFE, NEXT_STAY},
+	// Normal running
+	{0, COND_THROTTLE_NEUTRAL, 0, ANGLE_SERIAL, SPEED_SERIAL, NEXT_STAY},
+	{0, 0, 0, ANGLE_CAPTURE, SPEED_BRAKE, 1},
+	// Remote action detected
+	{1, COND_THROTTLE_NEUTRAL, 0, ANGLE_SERIAL, SPEED_SERIAL, 0}, // False alarm
+	{1, COND_ELAPSED_5, 0, ANGLE_CAPTURE, SPEED_BRAKE, 2},
+	{1, 0, 0, ANGLE_CAPTURE, SPEED_BRAKE, NEXT_STAY},
+	// Paused, remote pressed, waiting for release
+	{2, COND_THROTTLE_NEUTRAL, 0, ANGLE_CAPTURE, SPEED_NEUTRAL, 3},
+	{2, 0, 0, ANGLE_CAPTURE, SPEED_BRAKE, NEXT_STAY},
+	// Remote released
+	{3, COND_THROTTLE_NEUTRAL | COND_ELAPSED_5, 0, ANGLE_CAPTURE, SPEED_NEUTRAL, 4},
+	{3, COND_THROTTLE_NEUTRAL, 0, ANGLE_CAPTURE, SPEED_NEUTRAL, NEXT_STAY},
+	{3, 0, 0, ANGLE_CAPTURE, SPEED_BRAKE, 2}, // Remote is still pressed
+	// Proper pause, nothing is pressed anymore
+	{4, COND_THROTTLE_NEUTRAL, 0, ANGLE_CAPTURE, SPEED_NEUTRAL, NEXT_STAY},
+	{4, 0, 0, ANGLE_CAPTURE, SPEED_NEUTRAL, 5},
+	// Proper pause, press detected
+	{5, COND_THROTTLE_NEUTRAL, 0, ANGLE_CAPTURE, SPEED_NEUTRAL, 4}, // False alarm
+	{5, COND_ELAPSED_5, 0, ANGLE_CAPTURE, SPEED_NEUTRAL, 6},
+	{5, 0, 0, ANGLE_CAPTURE, SPEED_NEUTRAL, NEXT_STAY},
+	// Proper pause, remote pressed
+	{6, COND_THROTTLE_NEUTRAL | COND_ELAPSED_5, 0, ANGLE_CAPTURE, SPEED_NEUTRAL, 7},
+	{6, 0, 0, ANGLE_CAPTURE, SPEED_NEUTRAL, NEXT_STAY},
+	// Proper pause, release detected
+	{7, COND_THROTTLE_NEUTRAL | COND_ELAPSED_5, 0, ANGLE_CAPTURE, SPEED_NEUTRAL, 0}, // Unpause
+	{7, COND_THROTTLE_NEUTRAL, 0, ANGLE_CAPTURE, SPEED_NEUTRAL, NEXT_STAY},
+	{7, 0, 0, ANGLE_CAPTURE, SPEED_NEUTRAL, 6}, // Still pressed, get back
+#define ROWS_END 47
+};
+
+// Indexed by (global_state >> 4)
+const struct mode_desc modes[] PROGMEM = {
+	{ROWS_BOOT,              ROWS_REMOTE_ONLY - ROWS_BOOT,              0},         // SB_BOOT
+	{ROWS_REMOTE_ONLY,       ROWS_REMOTE_STATE_DEMO - ROWS_REMOTE_ONLY, 0},         // SB_REMOTE_ONLY
+	{ROWS_REMOTE_STATE_DEMO, ROWS_SERIAL_ONLY - ROWS_REMOTE_STATE_DEMO, 0},         // SB_REMOTE_STATE_DEMO
+	{ROWS_SERIAL_ONLY,       ROWS_TAKEOVER - ROWS_SERIAL_ONLY,          0},         // SB_SERIAL_ONLY
+	{ROWS_TAKEOVER,          ROWS_SPEED_LIMIT - ROWS_TAKEOVER,          MODE_TRIM}, // SB_TAKEOVER_WITH_TRIM
+	{ROWS_TAKEOVER,          ROWS_SPEED_LIMIT - ROWS_TAKEOVER,          0},         // SB_TAKEOVER
+	{ROWS_SPEED_LIMIT,       ROWS_PAUSE - ROWS_SPEED_LIMIT,             MODE_TRIM}, // SB_SPEED_LIMIT
+	{ROWS_PAUSE,             ROWS_END - ROWS_PAUSE,                     MODE_TRIM}, // SB_PAUSE
+};
+
+#define MODES_COUNT (sizeof(modes) / sizeof(modes[0]))
+_Static_assert(sizeof(mode_rows) / sizeof(mode_rows[0]) == ROWS_END, "ROWS_* offsets do not match mode_rows");
+
+// Largest number of rows evaluated in one pass
+uint8_t mode_engine_max_rows = 0;
+// Longest select_action() in CPU cycles (measured by main(), includes interrupts)
+uint16_t mode_engine_max_cycles = 0;
+
+uint16_t mode_conditions(uint16_t capture_speed_state) {
+	uint16_t conditions = 0;
+	uint16_t elapsed = time - substate_start_time;
+
+	if (serial_data_age > serial_timeout)
+		conditions |= COND_SERIAL_TIMEOUT;
+	if ((capture_speed_data_age > INPUT_CAPTURE_TIMEOUT) || (capture_dropout & CAPTURE_DROPOUT_SPEED))
+		conditions |= COND_CAPTURE_SPEED_TIMEOUT;
+	if ((capture_angle_data_age > INPUT_CAPTURE_TIMEOUT) || (capture_dropout & CAPTURE_DROPOUT_ANGLE))
+		conditions |= COND_CAPTURE_ANGLE_TIMEOUT;
+	if (serial_data_age >= SERIAL_MODES_TIMEOUT)
+		conditions |= COND_SERIAL_MODES_TIMEOUT;
+
+	if (capture_speed_state > 1500)
+		conditions |= COND_THROTTLE_FORWARD;
+	else if (capture_speed_state < 1500)
+		conditions |= COND_THROTTLE_BACKWARD;
+	else
+		conditions |= COND_THROTTLE_NEUTRAL;
+
+	if (elapsed > 5)
+		conditions |= COND_ELAPSED_5;
+	if (elapsed > 200)
+		conditions |= COND_ELAPSED_200;
+	if (elapsed > 300)
+		conditions |= COND_ELAPSED_300;
+	return conditions;
+}
+
 void select_action(void) {
+	struct mode_desc mode;
+	struct mode_row row;
 	int16_t trim = 0;
+	uint8_t substate = global_state & (~SB_MASK);
+	uint8_t i;
 	uint16_t capture_speed_state = capture_us_to_speed_state(capture_speed_us);
-	switch (global_state & SB_MASK) {
-		case SB_BOOT:
-			speed_controller_try_set_speed_state(1500);
-			if (time - substate_start_time > 300) {// Wait first three seconds
-				global_state = SB_DEFAULT_STATE;
-				substate_start_time = time;
-			}
-			break;
+	uint16_t conditions = mode_conditions(capture_speed_state);
 
-		case SB_REMOTE_ONLY:
-			speed_controller_try_set_angle_us(capture_angle_us);
-			if (capture_speed_data_age > INPUT_CAPTURE_TIMEOUT) {
-				// Safety timeout: speed input capture (disconnected wire, dead receiver)
-				speed_controller_try_set_speed_state(1500);
-				break;
-			}
-			speed_controller_try_set_speed_us(capture_speed_us);
-			debug++;
-			break;
+	if ((global_state >> 4) >= MODES_COUNT) {
+		failsafe_pass_done();
+		return; // Unknown mode, do nothing
+	}
+	memcpy_P(&mode, &modes[global_state >> 4], sizeof(mode));
+
+	for (i = 0; i < mode.rows; i++) {
+		memcpy_P(&row, &mode_rows[mode.first_row + i], sizeof(row));
+		if ((row.substate != SUBSTATE_ANY) && (row.substate != substate))
+			continue;
+		if ((conditions & row.all) != row.all)
+			continue;
+		if (row.any && !(conditions & row.any))
+			continue;
+		break;
+	}
+	if (i == mode.rows) {
+		if (mode.rows > mode_engine_max_rows)
+			mode_engine_max_rows = mode.rows; // All rows evaluated
+		failsafe_pass_done();
+		return; // No row matches (unknown substate), do nothing
+	}
+	if (i >= mode_engine_max_rows)
+		mode_engine_max_rows = i + 1;
 
-		case SB_REMOTE_STATE_DEMO:
-			speed_controller_try_set_angle_us(capture_angle_us);
-			if (capture_speed_data_age > INPUT_CAPTURE_TIMEOUT) {
-				// Safety timeout: speed input capture (disconnected wire, dead receiver)
-				speed_controller_try_set_speed_state(1500);
-				break;
-			}
-			if (capture_speed_state > 1500)
-				speed_controller_try_set_speed_state(2000); // Forward
-			else if (capture_speed_state < 1500)
-				speed_controller_try_set_speed_state(1000 | 0x4000); // Backward
-			else
-				speed_controller_try_set_speed_state(1000 | 0x8000); // Brake
-			break;
+	if (mode.flags & MODE_TRIM)
+		trim = capture_angle_us - current_config.angle_trim;
 
-		case SB_SERIAL_ONLY:
-			if (serial_data_age >= SERIAL_MODES_TIMEOUT) {
-				// SERIAL_MODES_TIMEOUT/100 seconds without signal, switch to default state
-				global_state = SB_DEFAULT_STATE;
-				substate_start_time = time;
-			}
-			speed_controller_try_set_angle_state(serial_angle_us);
-			if (serial_data_age > serial_timeout) {
-				// Safety no serial signal timeout
-				speed_controller_try_set_speed_state(1500);
-				break;
-			}
-			speed_controller_try_set_speed_state(serial_speed_us);
+	switch (row.angle) {
+		case ANGLE_CAPTURE:
+			speed_controller_try_set_angle_us(curve_apply_us(&steering_curve, capture_angle_us, current_config.angle_trim));
 			break;
-
-		case SB_TAKEOVER_WITH_TRIM:
-			trim = capture_angle_us - current_config.angle_trim;
-		case SB_TAKEOVER:
-			if (serial_data_age >= SERIAL_MODES_TIMEOUT) {
-				// SERIAL_MODES_TIMEOUT/100 seconds without signal, switch to default state
-				global_state = SB_DEFAULT_STATE;
-				substate_start_time = time;
-			}
-			if ((capture_angle_data_age > INPUT_CAPTURE_TIMEOUT) || (capture_speed_data_age > INPUT_CAPTURE_TIMEOUT)) {
-				// Safety timeout: speed or angle input capture (disconnected wire, dead receiver)
-				speed_controller_try_set_angle_state(serial_angle_us + trim);
-				speed_controller_try_set_speed_state(1500);
-				break;
-			}
-			if ((capture_speed_state != 1500) || (serial_data_age > serial_timeout)) {
-				// Takeover -- speed knob is not in neutral
-				speed_controller_try_set_angle_us(capture_angle_us);
-				speed_controller_try_set_speed_state(capture_speed_state | 0x4000);
-				if ((global_state & (~SB_MASK)) == 0) {
-					switch_to_substate(1);
-				}
-				else {
-					if (time - substate_start_time > 5) // We were in substate 1 for more than (5 * 10) ms
-						switch_to_substate(2); // We might already be in 2, in that case just reset the timer...
-				}
-				break;
-			}
-			if ((global_state & (~SB_MASK)) == 2 ) {
-				// Remote released, spend some time in paused substate (2) before serial line takes the control
-				speed_controller_try_set_angle_us(capture_angle_us);
-				speed_controller_try_set_speed_state(capture_speed_state | 0x4000);
-				if (time - substate_start_time > 200) // Released for two seconds, return to serial
-					switch_to_substate(0);
-				break;
-			}
-			else {
-				// We were in substate 1 for just a few measurements, return control to serial immediatelly
-				switch_to_substate(0);
-			}
+		case ANGLE_SERIAL:
 			speed_controller_try_set_angle_state(serial_angle_us + trim);
-			speed_controller_try_set_speed_state(serial_speed_us);
 			break;
+	}
 
-		case SB_SPEED_LIMIT:
-			if (serial_data_age >= SERIAL_MODES_TIMEOUT) {
-				// SERIAL_MODES_TIMEOUT/100 seconds without signal, switch to default state
-				global_state = SB_DEFAULT_STATE;
-				substate_start_time = time;
-			}
-			trim = capture_angle_us - current_config.angle_trim;
-			if ((capture_angle_data_age > INPUT_CAPTURE_TIMEOUT) || (capture_speed_data_age > INPUT_CAPTURE_TIMEOUT) || (serial_data_age > serial_timeout)) {
-				// Safety timeout: speed or angle input capture (disconnected wire, dead receiver) or no serial data
-				speed_controller_try_set_angle_state(serial_angle_us + trim);
-				speed_controller_try_set_speed_state(1500);
-				break;
-			}
-			speed_controller_try_set_angle_state(serial_angle_us + trim);
-			if (capture_speed_state > 1500) {
-				speed_controller_try_set_speed_state(limit_speed_state_with_speed_state(serial_speed_us, capture_speed_state));
-			}
-			else {
-				speed_controller_try_set_speed_state(1500);
-			}
+	switch (row.speed) {
+		case SPEED_NEUTRAL:
+			speed_controller_try_set_speed_state(1500);
 			break;
-
-		case SB_PAUSE:
-			trim = capture_angle_us - current_config.angle_trim;
-			if (serial_data_age >= SERIAL_MODES_TIMEOUT) {
-				// SERIAL_MODES_TIMEOUT/100 seconds without signal, switch to default state
-				global_state = SB_DEFAULT_STATE;
-				substate_start_time = time;
-			}
-			if ((capture_angle_data_age > INPUT_CAPTURE_TIMEOUT) || (capture_speed_data_age > INPUT_CAPTURE_TIMEOUT) || (serial_data_age > serial_timeout)) {
-				// Safety timeout: speed or angle input capture (disconnected wire, dead receiver) or no serial data
-				speed_controller_try_set_angle_state(serial_angle_us + trim);
-				speed_controller_try_set_speed_state(1500);
-				break;
-			}
-			if ((global_state & (~SB_MASK)) == 0) {
-				// Normal running
-				if (capture_speed_state != 1500) {
-					// Remote action detected
-					// Brake -- speed knob is not in neutral
-					speed_controller_try_set_angle_us(capture_angle_us);
-					speed_controller_try_set_speed_state(1000 | 0x8000);
-					switch_to_substate(1); // Start time measurement
-				}
-				else {
-					// Use data from serial line
-					speed_controller_try_set_angle_state(serial_angle_us + trim);
-					speed_controller_try_set_speed_state(serial_speed_us);
-				}
-			}
-			else if ((global_state & (~SB_MASK)) == 1) {
-				// Remote action detected
-				if (capture_speed_state != 1500) {
-					// Remote action detected
-					// Brake -- speed knob is not in neutral
-					speed_controller_try_set_angle_us(capture_angle_us);
-					speed_controller_try_set_speed_state(1000 | 0x8000);
-					if (time - substate_start_time > 5) // We were in substate 1 for more than (5 * 10) ms
-						switch_to_substate(2);
-				}
-				else {
-					// False alarm, continue running normaly
-					switch_to_substate(0);
-					speed_controller_try_set_angle_state(serial_angle_us + trim);
-					speed_controller_try_set_speed_state(serial_speed_us);
-				}
-			}
-			else if ((global_state & (~SB_MASK)) == 2) {
-				// Paused, button pressed, waiting for release
-				if (capture_speed_state != 1500) {
-					// Remote is still active
-					// Brake -- speed knob is not in neutral
-					speed_controller_try_set_angle_us(capture_angle_us);
-					speed_controller_try_set_speed_state(1000 | 0x8000);
-				}
-				else {
-					// Remote released
-					switch_to_substate(3);
-					speed_controller_try_set_angle_us(capture_angle_us);
-					speed_controller_try_set_speed_state(1500);
-				}
-			}
-			else if ((global_state & (~SB_MASK)) == 3) {
-				// Remote released
-				if (capture_speed_state != 1500) {
-					// False signal, remote is still pressed
-					// Brake -- speed knob is not in neutral
-					switch_to_substate(2);
-					speed_controller_try_set_angle_us(capture_angle_us);
-					speed_controller_try_set_speed_state(1000 | 0x8000);
-				}
-				else {
-					speed_controller_try_set_angle_us(capture_angle_us);
-					speed_controller_try_set_speed_state(1500);
-					if (time - substate_start_time > 5) // Remote was released for more than (5 * 10) ms
-						switch_to_substate(4);
-				}
-			}
-			else if ((global_state & (~SB_MASK)) == 4) {
-				// Proper pause, nothing is pressed anymore
-				speed_controller_try_set_angle_us(capture_angle_us);
-				speed_controller_try_set_speed_state(1500);
-				if (capture_speed_state != 1500) {
-					// New press
-					switch_to_substate(5);
-				}
-			}
-			else if ((global_state & (~SB_MASK)) == 5) {
-				// Proper pause, press detected
-				speed_controller_try_set_angle_us(capture_angle_us);
-				speed_controller_try_set_speed_state(1500);
-				if (capture_speed_state != 1500) {
-					if (time - substate_start_time > 5) // Remote was pressed for more than (5 * 10) ms
-						switch_to_substate(6);
-				}
-				else {
-					// False alarm, still nothing pressed
-					switch_to_substate(4);
-				}
-			}
-			else if ((global_state & (~SB_MASK)) == 6) {
-				// Proper pause, remote pressed
-				speed_controller_try_set_angle_us(capture_angle_us);
-				speed_controller_try_set_speed_state(1500);
-				if (capture_speed_state != 1500) {
-				}
-				else {
-					// Release
-					if (time - substate_start_time > 5) // Remote was released for more than (5 * 10) ms
-						switch_to_substate(7);
-				}
-			}
-			else if ((global_state & (~SB_MASK)) == 7) {
-				// Proper pause, release detected
-				speed_controller_try_set_angle_us(capture_angle_us);
-				speed_controller_try_set_speed_state(1500);
-				if (capture_speed_state != 1500) {
-					// Nope, still pressed, get back
-					switch_to_substate(6);
-				}
-				else {
-					// Release
-					if (time - substate_start_time > 5) // Remote was released for more than (5 * 10) ms
-						switch_to_substate(0); // Unpause
-				}
-			}
+		case SPEED_CAPTURE:
+			speed_controller_try_set_speed_us(capture_us_apply_curve(capture_speed_us));
+			debug++; // Counts passes with receiver in control (SB_REMOTE_ONLY)
+			break;
+		case SPEED_CAPTURE_STATE:
+			speed_controller_try_set_speed_state(capture_speed_state | 0x4000);
+			break;
+		case SPEED_SERIAL:
+			speed_controller_try_set_speed_state(serial_speed_state());
+			break;
+		case SPEED_SERIAL_LIMIT:
+			speed_controller_try_set_speed_state(limit_speed_state_with_speed_state(serial_speed_state(), capture_speed_state));
 			break;
+		case SPEED_FORWARD:
+			speed_controller_try_set_speed_state(2000);
+			break;
+		case SPEED_BACKWARD:
+			speed_controller_try_set_speed_state(1000 | 0x4000);
+			break;
+		case SPEED_BRAKE:
+			speed_controller_try_set_speed_state(1000 | 0x8000);
+			break;
+		case SPEED_FAILSAFE:
+			failsafe_apply(conditions & row.any & COND_INPUT_TIMEOUTS, time);
+			break;
+	}
+
+	if (row.next == NEXT_DEFAULT_MODE) {
+		global_state = SB_DEFAULT_STATE;
+		substate_start_time = time;
+	}
+	else if (row.next != NEXT_STAY) {
+		switch_to_substate(row.next);
 	}
+	failsafe_pass_done();
+}
 
+#if SERVO_CHANNELS > 2
+// Extra channels are controlled only from serial line, they keep the last value
+void select_extra_channels(void) {
+	if (serial_channels_pending && speed_controller_try_set_channels_us(serial_channel_us))
+		serial_channels_pending = 0;
 }
+#endif
 
+#ifndef HOST_BUILD
 int main(void) {
-	DDRB |= _BV(PB5); // LED output enable
+	uint8_t previous_state;
+	uint16_t previous_start_time;
+	struct servo_stopwatch stopwatch;
+	uint16_t cycles;
+
+	LED_DDR |= _BV(LED_BIT); // LED output enable
 
 	servo_init();
 	uart_init();
 	input_capture_init();
+	wheel_encoder_init();
+	scheduler_init();
 	sei();
 
 
-	// XXX: uart_.*_tick() functions has to be called at least each 75 us
-	// (given current uart speed). So we would be just fine with calling
-	// them just once per whole loop.
+	// Each pass is started by an interrupt: received or sent byte, finished
+	// input capture or Timer1 TOP. (Other interrupts do not end the sleep.)
+	// uart_.*_tick() functions has to be called at least each 75 us (given
+	// current uart speed), so they are interleaved with other tasks.
 	while (1) {
-		PORTB |= _BV(PB5);
+		LED_PORT |= _BV(LED_BIT);
 		uart_input_tick();
 		uart_output_tick();
 		check_timer_overflow();
@@ -421,8 +656,23 @@ int main(void) {
 		uart_input_tick();
 		uart_output_tick();
 
+		previous_state = global_state;
+		previous_start_time = substate_start_time;
 		switch_state_serial();
-		PORTB &= ~(_BV(PB5));
+		servo_stopwatch_start(&stopwatch);
 		select_action();
+		cycles = servo_stopwatch_ticks(&stopwatch) << 3; // 8 cycles per tick
+		if (cycles > mode_engine_max_cycles)
+			mode_engine_max_cycles = cycles;
+#if SERVO_CHANNELS > 2
+		select_extra_channels();
+#endif
+		LED_PORT &= ~(_BV(LED_BIT));
+
+		// New mode or substate has to act in the next pass, otherwise outputs
+		// are set and nothing changes until next interrupt.
+		if ((global_state == previous_state) && (substate_start_time == previous_start_time))
+			scheduler_sleep(out_buffer_len > out_buffer_pos);
 	}
 }
+#endif
@@ -0,0 +1,225 @@
+#include "global.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <stdint.h>
+#include <string.h>
+#include "hw.h"
+#include "input_capture.h"
+#include "speed_controller.h"
+#include "speed_loop.h"
+#include "failsafe.h"
+#include "wheel_encoder.h"
+#include "curve.h"
+#include "registers.h"
+
+// Variables of main.c and speed_controller.c without header
+extern uint8_t global_state;
+extern uint16_t debug;
+extern uint16_t time;
+extern uint16_t substate_start_time;
+extern uint16_t capture_speed_us;
+extern uint16_t capture_angle_us;
+extern uint8_t capture_speed_data_age;
+extern uint8_t capture_angle_data_age;
+extern struct capture_filter capture_speed_filter;
+extern struct capture_filter capture_angle_filter;
+extern uint16_t serial_data_age;
+extern uint8_t mode_engine_max_rows;
+extern uint16_t mode_engine_max_cycles;
+extern uint8_t transition_counter;
+
+// Register flags
+#define REGISTER_16BIT    0x01
+#define REGISTER_WRITABLE 0x02
+
+struct register_desc {
+	void *address;
+	uint8_t flags;
+};
+
+#define RO8(variable)  {(void *) &(variable), 0}
+#define RO16(variable) {(void *) &(variable), REGISTER_16BIT}
+#define RW8(variable)  {(void *) &(variable), REGISTER_WRITABLE}
+#define RW16(variable) {(void *) &(variable), REGISTER_16BIT | REGISTER_WRITABLE}
+#define RW16_CURVE(c) \
+	RW16(c.y[0]), RW16(c.y[1]), RW16(c.y[2]), RW16(c.y[3]), RW16(c.y[4]), RW16(c.y[5]), \
+	RW16(c.y[6]), RW16(c.y[7]), RW16(c.y[8]), RW16(c.y[9]), RW16(c.y[10]), RW16(c.y[11]), \
+	RW16(c.y[12]), RW16(c.y[13]), RW16(c.y[14]), RW16(c.y[15]), RW16(c.y[16])
+
+// Register ID is index to this table, keep in sync with README.md and append only
+const struct register_desc register_table[] PROGMEM = {
+	// 0x00 State
+	RO8(global_state),
+	RO16(time),
+	RO16(substate_start_time),
+	RO8(speed_controller_current_state),
+	RO8(transition_counter),
+	RW16(debug),
+	// 0x06 Inputs
+	RO16(capture_speed_us),
+	RO16(capture_angle_us),
+	RO16(COUNTER_SPEED), // raw counters of the last pulse
+	RO16(COUNTER_ANGLE),
+	RO8(capture_speed_data_age),
+	RO8(capture_angle_data_age),
+	RO8(capture_speed_filter.rejected),
+	RO8(capture_angle_filter.rejected),
+	RO16(serial_data_age),
+	RO8(wheel_encoder_edges),
+	// 0x10 Closed loop, failsafe and mode engine
+	RO16(speed_loop_speed),
+	RO16(speed_loop_speed_state),
+	RO8(failsafe_reason),
+	RO16(failsafe_start_time),
+	RW8(mode_engine_max_rows), // write 0 to restart the measurement
+	// 0x15 Speed controller configuration
+	RW16(current_config.angle_trim),
+	RW16(current_config.max_forward),
+	RW16(current_config.min_forward_moving),
+	RW16(current_config.min_forward),
+	RW16(current_config.max_neutral),
+	RW16(current_config.min_neutral),
+	RW16(current_config.max_backward),
+	RW16(current_config.max_backward_moving),
+	RW16(current_config.min_backward),
+	RW8(current_config.transition_filter),
+	// 0x1F Other configuration
+	RW16(speed_loop_config.kp),
+	RW16(speed_loop_config.ki),
+	RW16(speed_loop_config.integral_limit),
+	RW16(failsafe_config.brake_state),
+	RW8(failsafe_config.brake_time),
+	RW16(capture_filter_config.min_us),
+	RW16(capture_filter_config.max_us),
+	// 0x26 Response curves
+	RW16_CURVE(steering_curve),
+	RW16_CURVE(throttle_curve),
+	// 0x48 Measurements
+	RW16(mode_engine_max_cycles), // write 0 to restart the measurement
+	RW8(capture_filter_config.dropout_periods),
+};
+
+#define REGISTERS_COUNT (sizeof(register_table) / sizeof(register_table[0]))
+
+// Batch waiting for the next period (count 0 = none)
+uint8_t registers_pending_count = 0;
+unsigned char registers_pending[3 * REGISTERS_BATCH_MAX];
+// Streamed register IDs
+uint8_t registers_stream_count = 0;
+uint8_t registers_stream_ids[REGISTERS_BATCH_MAX];
+
+// Length of 'V' or 'W' packet, REGISTERS_INCOMPLETE until enough of it is received
+uint8_t registers_request_length(const unsigned char *packet, uint8_t len) {
+	uint8_t count;
+	uint8_t pos = 2;
+
+	if (len < 2)
+		return REGISTERS_INCOMPLETE;
+	count = packet[1];
+	if (count > REGISTERS_BATCH_MAX)
+		return REGISTERS_INVALID;
+	if (packet[0] == 'W')
+		return 2 + count;
+
+	for (uint8_t i = 0; i < count; i++) {
+		if (pos >= len)
+			return REGISTERS_INCOMPLETE;
+		pos += (packet[pos] & REGISTERS_WRITE) ? 3 : 1;
+	}
+	return pos + 1; // Checksum
+}
+
+// Complete 'V' packet, replaces batch which was not applied yet
+void registers_request(const unsigned char *packet) {
+	uint8_t len = registers_request_length(packet, REGISTERS_REQUEST_MAX_LEN) - 1;
+	uint8_t sum = 0;
+
+	for (uint8_t i = 0; i < len; i++)
+		sum += packet[i];
+	if (sum != packet[len])
+		return; // Corrupted packet, keep the pending batch
+	registers_pending_count = packet[1];
+	memcpy(registers_pending, packet + 2, len - 2);
+}
+
+// Complete 'W' packet
+void registers_stream(const unsigned char *packet) {
+	registers_stream_count = packet[1];
+	memcpy(registers_stream_ids, packet + 2, registers_stream_count);
+}
+
+// Access single register, value is written first if write is non-zero
+// Returns id with REGISTERS_WRITE bit set on error
+static uint8_t register_access(uint8_t id, uint8_t write, uint16_t *value) {
+	struct register_desc reg;
+
+	if (id >= REGISTERS_COUNT) {
+		*value = 0;
+		return id | REGISTERS_WRITE;
+	}
+	memcpy_P(&reg, &register_table[id], sizeof(reg));
+	if (write && !(reg.flags & REGISTER_WRITABLE)) {
+		id |= REGISTERS_WRITE;
+		write = 0;
+	}
+
+	// Raw counters are updated from interrupts
+	cli();
+	if (reg.flags & REGISTER_16BIT) {
+		if (write)
+			*(uint16_t *) reg.address = *value;
+		*value = *(uint16_t *) reg.address;
+	}
+	else {
+		if (write)
+			*(uint8_t *) reg.address = *value;
+		*value = *(uint8_t *) reg.address;
+	}
+	sei();
+	return id;
+}
+
+static uint8_t write_item(unsigned char *buffer, uint8_t id, uint16_t value) {
+	buffer[0] = id;
+	buffer[1] = value;
+	buffer[2] = (value >> 8);
+	return 3;
+}
+
+// Apply pending batch and write replies to buffer (call once per period from the main loop)
+// Reply which does not fit into `space` bytes is deferred: batch stays pending
+// (it is applied when it fits), streamed values are skipped in this period.
+// Returns number of bytes written, at most `space`
+uint8_t registers_write_replies(unsigned char *buffer, uint8_t space) {
+	uint8_t len = 0;
+	uint16_t value;
+	uint8_t id;
+
+	if (registers_pending_count && (2 + 3 * registers_pending_count <= space)) {
+		uint8_t pos = 0;
+		buffer[len++] = 'V';
+		buffer[len++] = registers_pending_count;
+		for (uint8_t i = 0; i < registers_pending_count; i++) {
+			id = registers_pending[pos++];
+			value = 0;
+			if (id & REGISTERS_WRITE) {
+				value = registers_pending[pos] | ((uint16_t) registers_pending[pos + 1]) << 8;
+				pos += 2;
+			}
+			id = register_access(id & ~REGISTERS_WRITE, id & REGISTERS_WRITE, &value);
+			len += write_item(buffer + len, id, value);
+		}
+		registers_pending_count = 0;
+	}
+
+	if (registers_stream_count && (len + 2 + 3 * registers_stream_count <= space)) {
+		buffer[len++] = 'W';
+		buffer[len++] = registers_stream_count;
+		for (uint8_t i = 0; i < registers_stream_count; i++) {
+			id = register_access(registers_stream_ids[i] & ~REGISTERS_WRITE, 0, &value);
+			len += write_item(buffer + len, id, value);
+		}
+	}
+	return len;
+}
@@ -0,0 +1,40 @@
+#ifndef _REGISTERS_H_
+#define _REGISTERS_H_
+
+#include <stdint.h>
+
+// Register map, firmware variables accessible from serial line by ID (see README.md for the list)
+//
+// Request packet 'V' (one batch, applied at the start of next Timer1 period):
+//  0      'V'
+//  1      number of items (at most REGISTERS_BATCH_MAX)
+//  2-     items: register ID, if REGISTERS_WRITE bit is set, new value follows (lower byte first)
+//  last   checksum: sum of all previous bytes (mod 256), packet with a wrong one is dropped
+//
+// Request packet 'W' (registers streamed in each period, count 0 stops streaming):
+//  0      'W'
+//  1      number of IDs (at most REGISTERS_BATCH_MAX)
+//  2-     register IDs
+//
+// Both are answered after telemetry by packet of the same tag (when it fits into
+// the period, see registers_write_replies()):
+//  0      'V' or 'W'
+//  1      number of items
+//  2-     items: register ID (REGISTERS_WRITE bit set when the ID is unknown or write
+//         to read-only register was requested), value after write (lower byte first)
+
+#define REGISTERS_BATCH_MAX     6
+#define REGISTERS_WRITE         0x80
+#define REGISTERS_REQUEST_MAX_LEN (2 + 3 * REGISTERS_BATCH_MAX + 1) // with checksum of 'V'
+#define REGISTERS_REPLY_MAX_LEN (2 + 3 * REGISTERS_BATCH_MAX)
+
+// Return values of registers_request_length()
+#define REGISTERS_INCOMPLETE    0
+#define REGISTERS_INVALID       0xFF
+
+uint8_t registers_request_length(const unsigned char *packet, uint8_t len);
+void registers_request(const unsigned char *packet);
+void registers_stream(const unsigned char *packet);
+uint8_t registers_write_replies(unsigned char *buffer, uint8_t space);
+
+#endif
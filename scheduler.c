@@ -0,0 +1,45 @@
+#include "global.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdint.h>
+#include "scheduler.h"
+#include "servo.h"
+#include "uart.h"
+#include "input_capture.h"
+#include "hw.h"
+
+void scheduler_init(void) {
+	set_sleep_mode(SLEEP_MODE_IDLE);     // Timers, USART and external interrupts keep running
+	SERVO_OVERFLOW_CLEAR();
+	TIFR1 = _BV(ICF1);                   // Clear interrupt flag (by writing one to it)
+	TIMSK1 |= _BV(ICIE1);                // Input Capture Interrupt Enable (ICF1 is set at TOP)
+}
+
+void scheduler_deinit(void) {
+	TIMSK1 &= ~_BV(ICIE1);               // Initial value
+	UCSR0B &= ~(_BV(RXCIE0) | _BV(UDRIE0));
+}
+
+// Is there anything for the main loop to do? (Called with interrupts disabled.)
+static uint8_t scheduler_work_waiting(uint8_t output_pending) {
+	return UART_INPUT_READY || SERVO_OVERFLOW || (output_pending && UART_OUTPUT_READY)
+		|| !INPUT_CAPTURE_SPEED_RUNNING() || !INPUT_CAPTURE_ANGLE_RUNNING();
+}
+
+void scheduler_sleep(uint8_t output_pending) {
+	cli();
+	// Other interrupts (timer overflows during capture, wheel encoder) wake
+	// us up as well, but there is no work for them, so sleep again
+	while (!scheduler_work_waiting(output_pending)) {
+		// USART interrupts only wake us up (their handlers disable them again)
+		UCSR0B |= _BV(RXCIE0) | (output_pending ? _BV(UDRIE0) : 0);
+		sleep_enable();
+		sei();
+		sleep_cpu();                 // Instruction after sei is always executed, so no wake-up can be lost
+		sleep_disable();
+		cli();
+	}
+	UCSR0B &= ~(_BV(RXCIE0) | _BV(UDRIE0)); // Do not delay input capture by them while awake
+	sei();
+}
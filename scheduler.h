@@ -0,0 +1,13 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <stdint.h>
+
+void scheduler_init(void);
+void scheduler_deinit(void);
+
+// Sleep in idle mode until there is some work waiting (received or sent byte,
+// finished input capture or Timer1 TOP), returns immediately if there is any
+void scheduler_sleep(uint8_t output_pending);
+
+#endif
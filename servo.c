@@ -7,24 +7,160 @@
 void set_angle_servo_us(uint16_t servo_angle) {
 	// Set length of servo signal in us. You can send signal that will make the servo crash to its endstop.
 	OCR1_ANGLE = servo_angle;
+	SERVO_COMMIT();
 }
 
 void set_speed_servo_us(uint16_t servo_speed) {
 	// Set length of servo signal in us. You can send signal that will make the servo crash to its endstop.
 	OCR1_SPEED = servo_speed;
+	SERVO_COMMIT();
 }
 
 
+#if SERVO_CHANNELS > 2
+/*
+ * Multi-output mode
+ *
+ * Channels are split into two banks: even channels are sequenced by OCR1A
+ * compare interrupt, odd ones by OCR1B. Pulses of one bank follow each other,
+ * so each event toggles falling edge of one channel and rising edge of the
+ * next one. Edge tables are double buffered: we build the inactive one and
+ * interrupt at TOP swaps them (if SERVO_COMMIT_BIT is set).
+ */
+uint16_t servo_channel_us[SERVO_CHANNELS];
+
+struct servo_event servo_events[2][2][SERVO_BANK_EVENTS]; // [table][bank][event]
+// Used by servo_asm.S, indexed by bank
+struct servo_event *servo_next[2];    // Next event
+struct servo_event *volatile servo_start[2]; // First event of active table (swapped at TOP)
+struct servo_event *servo_pending[2]; // First event of table used after commit
+
+static uint16_t servo_clamp_us(uint16_t us) {
+	if (us < SERVO_MULTI_MIN_US)
+		return SERVO_MULTI_MIN_US;
+	if (us > SERVO_MULTI_MAX_US)
+		return SERVO_MULTI_MAX_US;
+	return us;
+}
+
+static void servo_build_bank(struct servo_event *event, uint8_t bank, uint16_t start) {
+	uint8_t main_toggle = 0;
+	uint8_t extra_toggle = 0;
+	uint16_t time = start;
+
+	for (uint8_t channel = bank; channel < SERVO_CHANNELS; channel += 2) {
+		// Falling edge of previous channel, rising edge of this one
+		event->main_toggle = main_toggle | SERVO_MAIN_MASK(channel);
+		event->extra_toggle = extra_toggle | SERVO_EXTRA_MASK(channel);
+		time += servo_clamp_us(servo_channel_us[channel]) << 1; // 2 MHz timer clock
+		event->next_time = time;
+		event++;
+		main_toggle = SERVO_MAIN_MASK(channel);
+		extra_toggle = SERVO_EXTRA_MASK(channel);
+	}
+	// Last falling edge, then wait for next period
+	event->main_toggle = main_toggle;
+	event->extra_toggle = extra_toggle;
+	event->next_time = start;
+	event++;
+	// Spare event, used only if TOP was not handled in time
+	event->main_toggle = 0;
+	event->extra_toggle = 0;
+	event->next_time = start;
+}
+
+// New tables are used from the first TOP after we return. If TOP comes while
+// building them, it keeps the active ones and the new ones are used one period
+// later (callers check SERVO_UPDATE_SAFE_THRESHOLD, so only a long interrupt
+// can delay us that much).
+void servo_commit(void) {
+	uint8_t table;
+
+	GPIOR0 &= ~_BV(SERVO_COMMIT_BIT);    // Do not swap half-built table, servo_start cannot change now
+	table = (servo_start[0] == servo_events[0][0]) ? 1 : 0; // Inactive one
+	servo_build_bank(servo_events[table][0], 0, SERVO_BANK_A_START);
+	servo_build_bank(servo_events[table][1], 1, SERVO_BANK_B_START);
+	servo_pending[0] = servo_events[table][0];
+	servo_pending[1] = servo_events[table][1];
+	__asm__ __volatile__ ("" ::: "memory"); // Tables have to be written before the bit
+	GPIOR0 |= _BV(SERVO_COMMIT_BIT);
+}
+
+void servo_init(void) {
+	for (uint8_t channel = 2; channel < SERVO_CHANNELS; channel++)
+		servo_channel_us[channel] = 1500;             // default servo position in the middle
+	set_std_servo(0x80, 0x80);                        // default servo position in the middle (builds the tables)
+	GPIOR0 &= ~_BV(SERVO_COMMIT_BIT);                 // Use them right now
+	servo_start[0] = servo_next[0] = servo_pending[0];
+	servo_start[1] = servo_next[1] = servo_pending[1];
+
+	ICR1 = SERVO_MULTI_ICR1;                          // Selected signal period
+	OCR1A = SERVO_BANK_A_START;                       // First event of each bank
+	OCR1B = SERVO_BANK_B_START;
+	TCCR1A = 0;                                       // Normal port operation, pins disconnected
+	TCCR1B = (1<<WGM13) | (1<<WGM12) | (1<<CS11);     // WGM13, WGM12: CTC with TOP = ICR1, CS11: clk / 8 (--> 16 MHz / 8 = 2 MHz clock)
+	TIFR1 = (1<<OCF1A) | (1<<OCF1B);                  // Clear interrupt flags (by writing one to them)
+	TIMSK1 |= (1<<OCIE1A) | (1<<OCIE1B);              // Output Compare A/B Match Interrupt Enable
+
+	SERVO_MAIN_PORT &= ~(SERVO_MAIN_MASK(0) | SERVO_MAIN_MASK(1));
+	SERVO_EXTRA_PORT &= ~SERVO_EXTRA_MASK_ALL;
+	SERVO_MAIN_DDR |= SERVO_MAIN_MASK(0) | SERVO_MAIN_MASK(1); // Servo outputs enable
+	SERVO_EXTRA_DDR |= SERVO_EXTRA_MASK_ALL;
+}
+
+// Counter only counts up and restarts after TOP
+void servo_stopwatch_start(struct servo_stopwatch *stopwatch) {
+	stopwatch->start = SERVO_TCNT1;
+}
+
+uint16_t servo_stopwatch_ticks(const struct servo_stopwatch *stopwatch) {
+	uint16_t now = SERVO_TCNT1;
+	if (now < stopwatch->start)
+		now += SERVO_MULTI_ICR1 + 1;
+	return now - stopwatch->start;
+}
+
+void servo_deinit(void) {
+	SERVO_MAIN_DDR &= ~(SERVO_MAIN_MASK(0) | SERVO_MAIN_MASK(1)); // Servo outputs disable
+	SERVO_EXTRA_DDR &= ~SERVO_EXTRA_MASK_ALL;
+	TIMSK1 &= ~((1<<OCIE1A) | (1<<OCIE1B)); // Initial value
+	TCCR1A = 0;                          // Initial value
+	TCCR1B = 0;                          // Initial value
+	ICR1 = 0;                            // Initial value
+	OCR1A = 0;                           // Initial value
+	OCR1B = 0;                           // Initial value
+}
+
+#else
+
 void servo_init(void) {
 	set_std_servo(0x80, 0x80);                        // default servo position in the middle
 	ICR1 = SERVO_ICR1;                                // Selected signal period
 	TCCR1B = (1<<WGM13) | (1<<CS11);                  // WGM13, WGM11: PWM, Phase Correct, CS11: clk / 8 (--> 16 MHz / 8 = 2 MHz clock)
 	TCCR1A = (1<<COM1A1) | (1<<COM1B1) | (1<<WGM11);  // Clear OC1A/B when upcounting, set when downcounting, assign output pins, WGM11: update at TOP
-	DDRB |= _BV(PB1) | _BV(PB2);                      // Servo outputs enable
+	SERVO_MAIN_DDR |= _BV(SERVO_CHANNEL_0_BIT) | _BV(SERVO_CHANNEL_1_BIT); // Servo outputs enable
+}
+
+// Counter goes up to TOP and back down to BOTTOM, direction is given by which
+// of them was passed: TOP sets SERVO_OVERFLOW (the pass which cleared it is
+// running, so at most one TOP can come), BOTTOM sets TOV1 (no interrupt)
+void servo_stopwatch_start(struct servo_stopwatch *stopwatch) {
+	stopwatch->overflow = SERVO_OVERFLOW;
+	TIFR1 = _BV(TOV1);
+	stopwatch->start = TCNT1;
+}
+
+uint16_t servo_stopwatch_ticks(const struct servo_stopwatch *stopwatch) {
+	uint16_t now = TCNT1;
+	if (TIFR1 & _BV(TOV1))
+		return now + stopwatch->start;
+	if (SERVO_OVERFLOW && !stopwatch->overflow)
+		return 2 * SERVO_ICR1 - now - stopwatch->start;
+	return (now > stopwatch->start) ? now - stopwatch->start : stopwatch->start - now;
 }
 
 void servo_deinit(void) {
-	DDRB &= ~(_BV(PB1) | _BV(PB2));      // Servo outputs disable
+	SERVO_MAIN_DDR &= ~(_BV(SERVO_CHANNEL_0_BIT) | _BV(SERVO_CHANNEL_1_BIT)); // Servo outputs disable
 	TCCR1A = 0;                          // Initial value, Normal port operation, pins disconnected
 	TCCR1B = 0;                          // Initial value
 	ICR1 = 0;                            // Initial value
@@ -32,6 +168,8 @@ void servo_deinit(void) {
 	OCR1B = 0;                           // Initial value
 }
 
+#endif
+
 
 // Do not use following function when speed_controller is used
 void set_std_servo(uint8_t servo_speed, uint8_t servo_angle) {
@@ -39,6 +177,7 @@ void set_std_servo(uint8_t servo_speed, uint8_t servo_angle) {
 	// Registers are double buffered in PWM modes, so any change is glitch-free
 	OCR1_SPEED = STD_SERVO_OFFSET + ((uint16_t) servo_speed << 2);
 	OCR1_ANGLE = STD_SERVO_OFFSET + ((uint16_t) servo_angle << 2);
+	SERVO_COMMIT();
 }
 
 // Do not use following function when speed_controller is used
@@ -47,6 +186,7 @@ void set_ext_servo(uint8_t servo_speed, uint8_t servo_angle) {
 	// Registers are double buffered in PWM modes, so any change is glitch-free
 	OCR1_SPEED = EXT_SERVO_OFFSET + ((uint16_t) servo_speed << 3);
 	OCR1_ANGLE = EXT_SERVO_OFFSET + ((uint16_t) servo_angle << 3);
+	SERVO_COMMIT();
 }
 
 // Do not use following function when speed_controller is used
@@ -54,4 +194,5 @@ void set_servo_us(uint16_t servo_speed, uint16_t servo_angle) {
 	// Set length of servo signal in us. You can send signal that will make the servo crash to its endstop.
 	OCR1_SPEED = servo_speed;
 	OCR1_ANGLE = servo_angle;
+	SERVO_COMMIT();
 }
@@ -19,8 +19,68 @@
 void servo_init(void);
 void servo_deinit(void);
 
-#define SERVO_OVERFLOW (TIFR1 & (1<<ICF1))
-#define SERVO_OVERFLOW_CLEAR() do {TIFR1 |= 1<<ICF1;} while (0)
+#if SERVO_CHANNELS > 2
+#include <avr/interrupt.h>
+#include "hw.h"
+
+// Multi-output mode: Timer1 counts up only (CTC mode), pulses are generated by
+// compare interrupts in two banks of sequential pulses (see servo_asm.S)
+#define SERVO_MULTI_ICR1    (2 * SERVO_ICR1 - 1) // Same period as dual-slope mode
+#define SERVO_MULTI_MIN_US  500
+#define SERVO_MULTI_MAX_US  2400                 // Four pulses of one bank have to fit into the period
+#define SERVO_BANK_A_START  100                  // Timer value of first edge (OCR1A bank: even channels)
+#define SERVO_BANK_B_START  140                  // (OCR1B bank: odd channels)
+#define SERVO_BANK_EVENTS   ((SERVO_CHANNELS + 1) / 2 + 2) // Rising edge, one falling per channel, spare
+
+#define SERVO_MAIN_MASK(channel)  ((channel) == 0 ? _BV(SERVO_CHANNEL_0_BIT) : (channel) == 1 ? _BV(SERVO_CHANNEL_1_BIT) : 0)
+#define SERVO_EXTRA_MASK(channel) ((channel) < 2 ? 0 : _BV(SERVO_EXTRA_SHIFT + (channel) - 2))
+#define SERVO_EXTRA_MASK_ALL      (((1 << (SERVO_CHANNELS - 2)) - 1) << SERVO_EXTRA_SHIFT)
+
+// Layout is used by servo_asm.S
+struct servo_event {
+	uint8_t main_toggle;  // Pins toggled at this event
+	uint8_t extra_toggle;
+	uint16_t next_time;   // Timer value of the next event
+};
+
+extern uint16_t servo_channel_us[SERVO_CHANNELS];
+
+// Builds edge tables from servo_channel_us, they are used from the first TOP
+// after it returns (from the next one, if TOP comes during the build)
+void servo_commit(void);
+#define SERVO_COMMIT() servo_commit()
+
+// Compare interrupts write 16-bit registers of Timer1, which share one TEMP
+// register, so any 16-bit access has to be atomic
+static inline uint16_t servo_timer_value(void) {
+	uint8_t sreg = SREG;
+	uint16_t value;
+	cli();
+	value = TCNT1;
+	SREG = sreg;
+	return value;
+}
+#define SERVO_TCNT1 servo_timer_value()
+
+#else
+
+#define SERVO_COMMIT()
+#define SERVO_TCNT1 TCNT1
+
+#endif
+
+// ICF1 itself is cleared by its interrupt handler, which only copies it to GPIOR0 (see scheduler.c)
+#define SERVO_OVERFLOW (GPIOR0 & (1<<SERVO_OVERFLOW_BIT))
+#define SERVO_OVERFLOW_CLEAR() do {GPIOR0 &= ~(1<<SERVO_OVERFLOW_BIT);} while (0)
+
+// Measures duration of code shorter than half of the period in Timer1 ticks
+// (0.5 us = 8 CPU cycles), including interrupts which came in between
+struct servo_stopwatch {
+	uint16_t start;
+	uint8_t overflow; // SERVO_OVERFLOW at start
+};
+void servo_stopwatch_start(struct servo_stopwatch *stopwatch);
+uint16_t servo_stopwatch_ticks(const struct servo_stopwatch *stopwatch);
 
 // Do not use following functions when speed_controller is used
 void set_std_servo(uint8_t servo_speed, uint8_t servo_angle);
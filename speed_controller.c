@@ -4,6 +4,7 @@
 #include "servo.h"
 #include "hw.h"
 #include "speed_controller.h"
+#include "curve.h"
 
 struct speed_controller_config current_config = {
 	1510, // angle trim
@@ -103,27 +104,27 @@ uint16_t calculate_action(uint16_t desired_speed_state) {
 	}
 	else if (desired_speed > 1500) {
 		// Forward
-		return desired_speed - 1500 + current_config.min_forward_moving;
+		return curve_apply(&throttle_curve, desired_speed - 1500) + current_config.min_forward_moving;
 	}
 	else if (((desired_speed_state >> 8) & 0xC0) == 0x00) {
 		// Pass though, no state is enforced
-		return desired_speed - 1500 + current_config.max_backward_moving;
+		return curve_apply(&throttle_curve, desired_speed - 1500) + current_config.max_backward_moving;
 	}
 	else if (((desired_speed_state >> 8) & 0xC0) == 0x80) {
 		// Brake
 		if (speed_controller_current_state & 0x44) // if backward state might be active
 			return current_config.max_neutral + 1; // use smallest possible forwad speed
 		else
-			return desired_speed - 1500 + current_config.max_backward_moving; // Apply brakes
+			return curve_apply(&throttle_curve, desired_speed - 1500) + current_config.max_backward_moving; // Apply brakes
 	}
 	else {
 		// Backward movement
 		if (speed_controller_current_state & 0x11) // if forward might be active
-			return desired_speed - 1500 + current_config.max_backward_moving; // brake (or use selected backward speed)
+			return curve_apply(&throttle_curve, desired_speed - 1500) + current_config.max_backward_moving; // brake (or use selected backward speed)
 		else if (speed_controller_current_state & 0x22) // if brake might be active
 			return (current_config.min_forward + current_config.max_backward) / 2; // Neutral-2
 		else
-			return desired_speed - 1500 + current_config.max_backward_moving; // Finally: move backward
+			return curve_apply(&throttle_curve, desired_speed - 1500) + current_config.max_backward_moving; // Finally: move backward
 	}
 }
 
@@ -134,30 +135,63 @@ uint8_t speed_controller_try_set_speed_state(uint16_t speed_state) {
 }
 
 uint8_t speed_controller_try_set_speed_us(uint16_t speed_us) {
-	if (TCNT1 > SERVO_UPDATE_SAFE_THRESHOLD) // Do not change just before TOP
+	if (SERVO_TCNT1 > SERVO_UPDATE_SAFE_THRESHOLD) // Do not change just before TOP
 		return 0;
 	if (SERVO_OVERFLOW) // Do not change until the old value gets logged
 		return 0;
 
-	OCR1_SPEED = speed_us;
+	if (OCR1_SPEED != speed_us) {
+		OCR1_SPEED = speed_us;
+		SERVO_COMMIT(); // Rebuilds edge tables in multi-output mode, do it only when needed
+	}
 	return 1;
 }
 
+uint8_t speed_controller_try_set_neutral_1(void) {
+	if (speed_controller_current_state & 0x66) // if brake or backward might be active
+		return speed_controller_try_set_speed_us(current_config.max_neutral + 1); // use smallest possible forward speed (car does not move)
+	else
+		return speed_controller_try_set_speed_state(1500); // Neutral-1 stays neutral-1
+}
+
 uint8_t speed_controller_try_set_angle_state(uint16_t angle_state) {
-	uint16_t angle_us = angle_state + current_config.angle_trim - 1500;
+	uint16_t angle_us = curve_apply(&steering_curve, angle_state - 1500) + current_config.angle_trim;
 	return speed_controller_try_set_angle_us(angle_us);
 }
 
 uint8_t speed_controller_try_set_angle_us(uint16_t angle_us) {
-	if (TCNT1 > SERVO_UPDATE_SAFE_THRESHOLD) // Do not change just before TOP
+	if (SERVO_TCNT1 > SERVO_UPDATE_SAFE_THRESHOLD) // Do not change just before TOP
 		return 0;
 	if (SERVO_OVERFLOW) // Do not change until the old value gets logged
 		return 0;
 
-	OCR1_ANGLE = angle_us;
+	if (OCR1_ANGLE != angle_us) {
+		OCR1_ANGLE = angle_us;
+		SERVO_COMMIT(); // Rebuilds edge tables in multi-output mode, do it only when needed
+	}
 	return 1;
 }
 
+#if SERVO_CHANNELS > 2
+uint8_t speed_controller_try_set_channels_us(const uint16_t *channel_us) {
+	if (SERVO_TCNT1 > SERVO_UPDATE_SAFE_THRESHOLD) // Do not change just before TOP
+		return 0;
+	if (SERVO_OVERFLOW) // Do not change until the old value gets logged
+		return 0;
+
+	uint8_t changed = 0;
+	for (uint8_t channel = 0; channel < SERVO_CHANNELS; channel++) {
+		if (channel_us[channel] && (servo_channel_us[channel] != channel_us[channel])) {
+			servo_channel_us[channel] = channel_us[channel];
+			changed = 1;
+		}
+	}
+	if (changed)
+		SERVO_COMMIT();
+	return 1;
+}
+#endif
+
 uint16_t capture_us_to_speed_state(uint16_t speed_us) {
 	if (speed_us > current_config.min_forward_moving)
 		return speed_us - current_config.min_forward_moving + 1500;
@@ -167,6 +201,17 @@ uint16_t capture_us_to_speed_state(uint16_t speed_us) {
 		return 1500;
 }
 
+// Receiver pass-through: the same mapping as calculate_action() of
+// capture_us_to_speed_state(), signals inside the dead band are not changed
+uint16_t capture_us_apply_curve(uint16_t speed_us) {
+	if (speed_us > current_config.min_forward_moving)
+		return curve_apply(&throttle_curve, speed_us - current_config.min_forward_moving) + current_config.min_forward_moving;
+	else if (speed_us < current_config.max_backward_moving)
+		return curve_apply(&throttle_curve, speed_us - current_config.max_backward_moving) + current_config.max_backward_moving;
+	else
+		return speed_us;
+}
+
 uint16_t limit_speed_state_with_speed_state(uint16_t speed_state, uint16_t limit) {
 	uint16_t mode = 0xC000 & speed_state;
 	speed_state &= 0x3FFF;
@@ -4,7 +4,11 @@
 #include <stdint.h>
 #include "servo.h"
 
+#if SERVO_CHANNELS > 2
+#define SERVO_UPDATE_SAFE_THRESHOLD   (SERVO_MULTI_ICR1 - 200) // Building of edge tables takes some time
+#else
 #define SERVO_UPDATE_SAFE_THRESHOLD   (SERVO_ICR1 - 4)
+#endif
 
 struct speed_controller_config {
 	uint16_t angle_trim;
@@ -26,6 +30,7 @@ extern uint8_t speed_controller_current_state;
 void speed_controller_simulate_state(uint16_t set_speed);
 
 uint16_t capture_us_to_speed_state(uint16_t speed_us);
+uint16_t capture_us_apply_curve(uint16_t speed_us); // throttle_curve centered at both ends of dead band
 uint16_t limit_speed_state_with_speed_state(uint16_t speed_state, uint16_t limit);
 
 
@@ -37,7 +42,11 @@ uint8_t speed_controller_try_set_speed_state(uint16_t speed_state); // use for s
 // 10xx xxxx -- enforce brake (usefull for long emergency brake)
 
 uint8_t speed_controller_try_set_speed_us(uint16_t speed_us); // use for remote controll
+uint8_t speed_controller_try_set_neutral_1(void); // get out of brake/backward without moving
 uint8_t speed_controller_try_set_angle_state(uint16_t angle_state); // apply angle_trim
 uint8_t speed_controller_try_set_angle_us(uint16_t angle_us);
+#if SERVO_CHANNELS > 2
+uint8_t speed_controller_try_set_channels_us(const uint16_t *channel_us); // all channels at once, 0 keeps the channel unchanged
+#endif
 
 #endif
@@ -0,0 +1,68 @@
+#include "global.h"
+#include <stdint.h>
+#include "speed_loop.h"
+
+struct speed_loop_config speed_loop_config = {
+	64,    // kp: 100 edges of error --> 25 us
+	16,    // ki: scaled with the window, integral time is the same multiple of measurement delay
+	8000,  // integral limit: ki * limit is apx. full throttle
+};
+
+// Measured speed (edges in last SPEED_LOOP_WINDOW periods, scaled to 16 periods)
+// Moving sum delays it by SPEED_LOOP_WINDOW / 2 periods (20 ms)
+uint16_t speed_loop_speed = 0;
+// Output of the controller, same format as speed commands in the serial protocol
+uint16_t speed_loop_speed_state = 1500;
+
+uint8_t speed_loop_window[SPEED_LOOP_WINDOW];
+uint8_t speed_loop_window_pos = 0;
+uint16_t speed_loop_window_sum = 0;
+uint8_t speed_loop_last_edges = 0;
+int16_t speed_loop_integral = 0;
+
+// Run once per period with current value of wheel_encoder_edges
+void speed_loop_sample(uint8_t edges) {
+	uint8_t delta = edges - speed_loop_last_edges; // Counter wraps around
+	speed_loop_last_edges = edges;
+
+	speed_loop_window_sum -= speed_loop_window[speed_loop_window_pos];
+	speed_loop_window_sum += delta;
+	speed_loop_window[speed_loop_window_pos] = delta;
+	speed_loop_window_pos = (speed_loop_window_pos + 1) % SPEED_LOOP_WINDOW;
+	speed_loop_speed = speed_loop_window_sum << SPEED_LOOP_SCALE_SHIFT;
+}
+
+// Run once per period (after speed_loop_sample), when the closed loop is in control
+void speed_loop_update(uint16_t target_speed) {
+	int16_t error = (int16_t) (target_speed & ~SPEED_LOOP_ENABLE) - (int16_t) speed_loop_speed;
+	int32_t integral = (int32_t) speed_loop_integral + error;
+	int32_t output;
+
+	if (integral > speed_loop_config.integral_limit)
+		integral = speed_loop_config.integral_limit;
+	else if (integral < -speed_loop_config.integral_limit)
+		integral = -speed_loop_config.integral_limit;
+	speed_loop_integral = integral;
+
+	output = (int32_t) speed_loop_config.kp * error + (int32_t) speed_loop_config.ki * speed_loop_integral;
+	output >>= 8;
+	if (output > 500)
+		output = 500;
+	else if (output < -500)
+		output = -500;
+
+	if (output >= 0) {
+		// Forward (speed state 1500 is neutral)
+		speed_loop_speed_state = 1500 + output;
+	}
+	else {
+		// We are too fast: use brakes, but never let the driver switch to backward
+		speed_loop_speed_state = (1500 + output) | 0x8000;
+	}
+}
+
+// Run once per period, when the closed loop is not in control
+void speed_loop_reset(void) {
+	speed_loop_integral = 0;
+	speed_loop_speed_state = 1500;
+}
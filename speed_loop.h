@@ -0,0 +1,28 @@
+#ifndef _SPEED_LOOP_H_
+#define _SPEED_LOOP_H_
+
+#include <stdint.h>
+
+// Measured speed is number of encoder edges in last SPEED_LOOP_WINDOW periods,
+// scaled to edges per 16 periods (unit of target speed in serial protocol)
+#define SPEED_LOOP_WINDOW 4
+#define SPEED_LOOP_SCALE_SHIFT 2 // 16 = SPEED_LOOP_WINDOW << SPEED_LOOP_SCALE_SHIFT
+
+// Highest bit of target speed in serial packet enables the closed loop
+#define SPEED_LOOP_ENABLE 0x8000
+
+struct speed_loop_config {
+	int16_t kp;             // proportional gain (in 1/256 of speed state per edge)
+	int16_t ki;             // integral gain (in 1/256 of speed state per edge and period)
+	int16_t integral_limit; // anti-windup limit of error integral
+};
+
+extern struct speed_loop_config speed_loop_config;
+extern uint16_t speed_loop_speed;
+extern uint16_t speed_loop_speed_state;
+
+void speed_loop_sample(uint8_t edges);
+void speed_loop_update(uint16_t target_speed);
+void speed_loop_reset(void);
+
+#endif
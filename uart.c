@@ -2,12 +2,6 @@
 #include <avr/io.h>
 #include "uart.h"
 
-#ifndef BAUD_RATE
-#define BAUD_RATE	115200L
-#endif
-
-#define UBRR_U2X(baud)	(F_CPU / (8 * (baud) - 1))
-
 void uart_init(void) {
 	UBRR0 = UBRR_U2X(BAUD_RATE) - 1;
 	UCSR0C = _BV(UCSZ01) | _BV(UCSZ00); // Initial value - Asynchronous, No parity, 1 stop bit, 8-bit
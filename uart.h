@@ -2,6 +2,14 @@
 #define _UART_H_
 
 
+#ifndef BAUD_RATE
+#define BAUD_RATE	115200L
+#endif
+
+#define UBRR_U2X(baud)	(F_CPU / (8 * (baud) - 1))
+// Real transfer rate given by rounded UBRR0 (start + 8 data + stop bits per byte), 11764 B/s for 115200
+#define UART_BYTES_PER_SECOND	(F_CPU / (80 * UBRR_U2X(BAUD_RATE)))
+
 void uart_init(void);
 void uart_deinit(void);
 
@@ -0,0 +1,19 @@
+#include "global.h"
+#include <avr/io.h>
+#include <stdint.h>
+#include "wheel_encoder.h"
+#include "hw.h"
+
+void wheel_encoder_init(void) {
+	WHEEL_ENCODER_DDR &= ~_BV(WHEEL_ENCODER_BIT);  // Input
+	WHEEL_ENCODER_PORT |= _BV(WHEEL_ENCODER_BIT);  // Pull-up (no edges if nothing is connected)
+	WHEEL_ENCODER_PCMSK |= _BV(WHEEL_ENCODER_BIT); // Pin change interrupt only from encoder pin
+	PCIFR |= _BV(WHEEL_ENCODER_PCIF);              // Clear interrupt flag (by writing one to it)
+	PCICR |= _BV(WHEEL_ENCODER_PCIE);              // Enable pin change interrupt
+}
+
+void wheel_encoder_deinit(void) {
+	PCICR &= ~_BV(WHEEL_ENCODER_PCIE);             // Initial value
+	WHEEL_ENCODER_PCMSK &= ~_BV(WHEEL_ENCODER_BIT); // Initial value
+	WHEEL_ENCODER_PORT &= ~_BV(WHEEL_ENCODER_BIT);  // Initial value
+}
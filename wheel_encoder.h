@@ -0,0 +1,12 @@
+#ifndef _WHEEL_ENCODER_H_
+#define _WHEEL_ENCODER_H_
+
+#include <stdint.h>
+
+void wheel_encoder_init(void);
+void wheel_encoder_deinit(void);
+
+// Number of edges (both rising and falling), incremented by interrupt handler, wraps around
+extern volatile uint8_t wheel_encoder_edges;
+
+#endif